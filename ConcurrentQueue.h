@@ -0,0 +1,109 @@
+// ConcurrentQueue.h -- lock-free bounded queue between two threads
+//
+// Uses the same storage as epl::vector and epl::ring_buffer: one raw
+// operator new buffer, elements placement-new'ed in and destroyed by hand,
+// wraparound indexing. Exactly one thread may push and exactly one thread
+// may pop; head and tail live on separate cache lines so the two sides do
+// not keep stealing each other's line.
+
+#ifndef _concurrent_queue_h
+#define _concurrent_queue_h
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace epl{
+
+    static constexpr uint64_t cache_line = 64;
+
+    template <typename T>
+    class spsc_queue {
+    private:
+        uint64_t slots;     // capacity + 1, one slot always stays empty
+        T* data;
+
+        alignas(cache_line) std::atomic<uint64_t> head;    // next slot to pop, written by the consumer
+        uint64_t tail_cache;                               // consumer's last view of tail
+
+        alignas(cache_line) std::atomic<uint64_t> tail;    // next slot to push, written by the producer
+        uint64_t head_cache;                               // producer's last view of head
+
+    public:
+        explicit spsc_queue(uint64_t capacity):head(0),tail_cache(0),tail(0),head_cache(0){
+            if(capacity==0){
+                throw std::invalid_argument("spsc_queue needs a capacity");
+            }
+            slots = capacity+1;
+            data = reinterpret_cast<T*> (operator new(sizeof(T)*slots));
+        }
+
+        spsc_queue(spsc_queue const&) = delete;
+        spsc_queue& operator=(spsc_queue const&) = delete;
+
+        ~spsc_queue(void){
+            uint64_t h = head.load(std::memory_order_relaxed);
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            while(h!=t){
+                (data+h)->~T();
+                h = next(h);
+            }
+            operator delete (data);
+        }
+
+        uint64_t capacity(void) const{ return slots-1; }
+
+        // only a snapshot while both sides are running
+        uint64_t size(void) const{
+            uint64_t h = head.load(std::memory_order_acquire);
+            uint64_t t = tail.load(std::memory_order_acquire);
+            return (t>=h) ? t-h : t+slots-h;
+        }
+
+        bool empty(void) const{ return size()==0; }
+
+        /*********************producer side**************************/
+        bool try_push(T const& val){ return try_emplace(val); }
+        bool try_push(T&& val){ return try_emplace(std::move(val)); }
+
+        // false when the queue is full
+        template<typename... Args>
+        bool try_emplace(Args&&... args){
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            uint64_t n = next(t);
+            if(n==head_cache){
+                head_cache = head.load(std::memory_order_acquire);
+                if(n==head_cache) return false;
+            }
+            new (data+t) T{std::forward<Args>(args)...};
+            tail.store(n,std::memory_order_release);
+            return true;
+        }
+
+        /*********************consumer side**************************/
+        // false when the queue is empty
+        bool try_pop(T& out){
+            uint64_t h = head.load(std::memory_order_relaxed);
+            if(h==tail_cache){
+                tail_cache = tail.load(std::memory_order_acquire);
+                if(h==tail_cache) return false;
+            }
+            out = std::move(data[h]);
+            (data+h)->~T();
+            head.store(next(h),std::memory_order_release);
+            return true;
+        }
+
+    private:
+        uint64_t next(uint64_t index) const{
+            index++;
+            if(index>=slots) index -= slots;
+            return index;
+        }
+    };
+
+} //namespace epl
+
+#endif /* _concurrent_queue_h */
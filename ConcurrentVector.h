@@ -0,0 +1,232 @@
+// ConcurrentVector.h -- epl::vector variant that readers may scan while a writer appends
+//
+// One writer thread appends, any number of reader threads take snapshots.
+// A snapshot is a (buffer, length) pair that stays valid until it is
+// dropped: when push_back outgrows the buffer it copies the elements into
+// a new one and retires the old one instead of freeing it. Retired buffers
+// are reclaimed with a simple epoch scheme once no reader that could have
+// seen them is still pinned. The version counters are atomics so readers
+// can poll them without racing the writer.
+//
+// Elements are never moved or destroyed while published, so the vector is
+// append-only; changing existing elements while readers run is a race.
+
+#ifndef _concurrent_vector_h
+#define _concurrent_vector_h
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "ConcurrentQueue.h"
+
+namespace epl{
+
+    template <typename T>
+    class concurrent_vector {
+    private:
+        struct block{
+            T* elems;
+            uint64_t capacity;
+            std::atomic<uint64_t> len;
+            uint64_t retire_epoch;
+            block* next_retired;
+        };
+
+        struct alignas(cache_line) reader_slot{
+            std::atomic<uint64_t> epoch;    // 0 when free, otherwise the epoch the reader pinned
+        };
+
+        static constexpr uint64_t max_readers = 64;
+        static constexpr uint64_t first_capacity = 8;
+
+        std::atomic<block*> current;
+        block* retired;                     // writer only
+        std::atomic<uint64_t> global_epoch;
+        std::atomic<uint64_t> length;       // published elements, so size() needs no block
+        std::atomic<uint64_t> reallocate_times;
+        std::atomic<uint64_t> vector_version;
+        reader_slot readers[max_readers];
+
+    public:
+        /*********************read side**************************/
+        // a stable view of the elements published when it was taken
+        class snapshot{
+        private:
+            const T* ptr;
+            uint64_t len;
+            reader_slot* slot;
+
+        public:
+            friend concurrent_vector;
+
+            snapshot(snapshot const&) = delete;
+            snapshot& operator=(snapshot const&) = delete;
+
+            snapshot(snapshot&& that) noexcept:ptr(that.ptr),len(that.len),slot(that.slot){
+                that.slot = nullptr;
+            }
+
+            ~snapshot(void){
+                if(slot!=nullptr) slot->epoch.store(0,std::memory_order_release);
+            }
+
+            uint64_t size(void) const{ return len; }
+
+            const T& operator[](uint64_t k) const{
+                if(k>=len){
+                    throw std::out_of_range("subscript ouf of range");
+                }
+                return ptr[k];
+            }
+
+            const T* begin(void) const{ return ptr; }
+            const T* end(void) const{ return ptr+len; }
+
+        private:
+            snapshot(const T* p,uint64_t n,reader_slot* s):ptr(p),len(n),slot(s){}
+        };
+
+        concurrent_vector(void):retired(nullptr),global_epoch(1),length(0),reallocate_times(0),vector_version(0){
+            current.store(make_block(first_capacity),std::memory_order_relaxed);
+            for(uint64_t k = 0;k<max_readers;k++){
+                readers[k].epoch.store(0,std::memory_order_relaxed);
+            }
+        }
+
+        concurrent_vector(concurrent_vector const&) = delete;
+        concurrent_vector& operator=(concurrent_vector const&) = delete;
+
+        // no snapshot may outlive the vector
+        ~concurrent_vector(void){
+            free_block(current.load(std::memory_order_relaxed));
+            while(retired!=nullptr){
+                block* b = retired;
+                retired = b->next_retired;
+                free_block(b);
+            }
+        }
+
+        // pins the current epoch, then reads the buffer; the writer cannot free
+        // anything this reader might see until the snapshot is dropped
+        snapshot read(void){
+            for(uint64_t k = 0;k<max_readers;k++){
+                uint64_t expected = 0;
+                uint64_t e = global_epoch.load();
+                if(readers[k].epoch.compare_exchange_strong(expected,e)){
+                    block* b = current.load();
+                    return snapshot{b->elems,b->len.load(std::memory_order_acquire),&readers[k]};
+                }
+            }
+            throw std::runtime_error("too many concurrent readers");
+        }
+
+        // no epoch is pinned here: a block read without one may already be freed
+        uint64_t size(void) const{
+            return length.load(std::memory_order_acquire);
+        }
+
+        uint64_t version(void) const{ return vector_version.load(std::memory_order_acquire); }
+        uint64_t reallocations(void) const{ return reallocate_times.load(std::memory_order_acquire); }
+
+        /*********************write side, one thread only**************************/
+        void push_back(T const& val){ emplace_back(val); }
+        void push_back(T&& val){ emplace_back(std::move(val)); }
+
+        template<typename... Args>
+        void emplace_back(Args&&... args){
+            block* b = current.load(std::memory_order_relaxed);
+            uint64_t n = b->len.load(std::memory_order_relaxed);
+            if(n==b->capacity){
+                b = grow(b,std::forward<Args>(args)...);
+            }else{
+                new (b->elems+n) T{std::forward<Args>(args)...};
+                b->len.store(n+1,std::memory_order_release);
+            }
+            length.store(n+1,std::memory_order_release);
+            vector_version.fetch_add(1,std::memory_order_release);
+        }
+
+        // frees retired buffers that no pinned reader can still see
+        void reclaim(void){
+            uint64_t oldest = global_epoch.load();
+            for(uint64_t k = 0;k<max_readers;k++){
+                uint64_t e = readers[k].epoch.load();
+                if(e!=0&&e<oldest) oldest = e;
+            }
+            block** link = &retired;
+            while(*link!=nullptr){
+                block* b = *link;
+                if(b->retire_epoch<oldest){
+                    *link = b->next_retired;
+                    free_block(b);
+                }else{
+                    link = &b->next_retired;
+                }
+            }
+        }
+
+    private:
+        // the new element is built first since it may alias an old one; old
+        // elements are copied, readers may still be looking at them
+        template<typename... Args>
+        block* grow(block* old,Args&&... args){
+            uint64_t n = old->len.load(std::memory_order_relaxed);
+            block* b = make_block(old->capacity*2);
+            uint64_t k = 0;
+            bool built = false;
+            try{
+                new (b->elems+n) T{std::forward<Args>(args)...};
+                built = true;
+                if(std::is_trivially_copyable<T>::value){
+                    if(n) std::memcpy(static_cast<void*>(b->elems),old->elems,n*sizeof(T));
+                }else{
+                    for(;k<n;k++){
+                        new (b->elems+k) T{old->elems[k]};
+                    }
+                }
+            }catch(...){
+                if(built) (b->elems+n)->~T();
+                for(uint64_t i = 0;i<k;i++){
+                    (b->elems+i)->~T();
+                }
+                free_block(b);
+                throw;
+            }
+            b->len.store(n+1,std::memory_order_relaxed);
+            current.store(b);
+            // readers pinning a later epoch are guaranteed to see the new block
+            old->retire_epoch = global_epoch.fetch_add(1);
+            old->next_retired = retired;
+            retired = old;
+            reallocate_times.fetch_add(1,std::memory_order_release);
+            reclaim();
+            return b;
+        }
+
+        block* make_block(uint64_t capacity){
+            block* b = new block;
+            b->elems = reinterpret_cast<T*> (operator new(sizeof(T)*capacity));
+            b->capacity = capacity;
+            b->len.store(0,std::memory_order_relaxed);
+            b->retire_epoch = 0;
+            b->next_retired = nullptr;
+            return b;
+        }
+
+        void free_block(block* b){
+            uint64_t n = b->len.load(std::memory_order_relaxed);
+            for(uint64_t k = 0;k<n;k++){
+                (b->elems+k)->~T();
+            }
+            operator delete (b->elems);
+            delete b;
+        }
+    };
+
+} //namespace epl
+
+#endif /* _concurrent_vector_h */
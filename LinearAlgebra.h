@@ -0,0 +1,259 @@
+// LinearAlgebra.h -- blocked, packed, multithreaded GEMM and GEMV over valarray expressions
+//
+// #include "Vector.h" and "Valarray.h" before this file; dot() and outer()
+// live in Valarray.h itself.
+//
+// Matrices are 2-D expressions: ndview windows onto epl::vector storage,
+// or any lazy N-D expression of rank 2 built from them. gemm follows the
+// usual packed layout: a KC x NC block of B and an MC x KC block of A are
+// copied into contiguous panels (which is also where lazy operands get
+// evaluated, once per element per block), then an MR x NR register tile
+// of C is accumulated from the panels with packed multiply-adds. Row
+// blocks of A are spread over the epl::thread_pool.
+
+#ifndef _linear_algebra_h
+#define _linear_algebra_h
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+#include "ParallelAlgorithms.h"
+
+namespace gemm_detail{
+    static constexpr uint64_t MC = 64;      // rows of A per block
+    static constexpr uint64_t KC = 256;     // depth per block
+    static constexpr uint64_t NC = 1024;    // columns of B per block
+    static constexpr uint64_t MR = 4;       // register tile rows
+
+    // below this many multiply-adds the pool costs more than it saves
+    static constexpr uint64_t parallel_work = 64*64*64;
+
+    template<typename T>
+    using pack = simd_detail::simd_pack<T>;
+
+    template<typename T>
+    struct tile{
+        static constexpr uint64_t NR = 2*pack<T>::width;
+    };
+
+    /*****************************element access********************************/
+    // an ndview is read through its pointer and strides, anything else
+    // through at()
+    template<typename T,typename V>
+    struct reader{
+        const V& v;
+        explicit reader(const V& m):v(m){}
+        T operator()(uint64_t i,uint64_t j) const{
+            return static_cast<T>(v.at(nd_index<2>{i,j}));
+        }
+        // row i of the operand times x
+        T row_dot(uint64_t i,const T* x,uint64_t n) const{
+            return reduce_detail::sum<T>(n,[this,i,x](uint64_t j){ return (*this)(i,j)*x[j]; });
+        }
+    };
+    template<typename T,typename U>
+    struct reader<T,ndview<U,2>>{
+        const U* base;
+        int64_t s0,s1;
+        explicit reader(const ndview<U,2>& m):base(m.data()),s0(m.stride()[0]),s1(m.stride()[1]){}
+        T operator()(uint64_t i,uint64_t j) const{
+            return static_cast<T>(base[static_cast<int64_t>(i)*s0+static_cast<int64_t>(j)*s1]);
+        }
+        T row_dot(uint64_t i,const T* x,uint64_t n) const{
+            const U* row = base+static_cast<int64_t>(i)*s0;
+            if(s1==1){
+                return reduce_detail::sum<T>(n,[row,x](uint64_t j){ return static_cast<T>(row[j])*x[j]; });
+            }
+            int64_t step = s1;
+            return reduce_detail::sum<T>(n,[row,step,x](uint64_t j){ return static_cast<T>(row[static_cast<int64_t>(j)*step])*x[j]; });
+        }
+    };
+    template<typename T,typename V>
+    struct reader<T,Wrap<V>>:reader<T,V>{
+        using reader<T,V>::reader;
+    };
+
+    /*****************************packing********************************/
+    // rows [i0, i0+mc) by depth [p0, p0+kc) of A into MR-row panels,
+    // element (r,k) of panel q at (q*kc+k)*MR+r; short panels are zero padded
+    template<typename T,typename R>
+    void pack_a(T* out,const R& a,uint64_t i0,uint64_t mc,uint64_t p0,uint64_t kc){
+        for(uint64_t q = 0;q*MR<mc;q++){
+            T* panel = out+q*kc*MR;
+            for(uint64_t k = 0;k<kc;k++){
+                for(uint64_t r = 0;r<MR;r++){
+                    uint64_t i = q*MR+r;
+                    panel[k*MR+r] = i<mc ? a(i0+i,p0+k) : T(0);
+                }
+            }
+        }
+    }
+
+    // depth [p0, p0+kc) by columns [j0, j0+nc) of B into NR-column panels
+    template<typename T,typename R>
+    void pack_b(T* out,const R& b,uint64_t p0,uint64_t kc,uint64_t j0,uint64_t nc){
+        constexpr uint64_t NR = tile<T>::NR;
+        for(uint64_t q = 0;q*NR<nc;q++){
+            T* panel = out+q*kc*NR;
+            for(uint64_t k = 0;k<kc;k++){
+                for(uint64_t c = 0;c<NR;c++){
+                    uint64_t j = q*NR+c;
+                    panel[k*NR+c] = j<nc ? b(p0+k,j0+j) : T(0);
+                }
+            }
+        }
+    }
+
+    /*****************************register tile********************************/
+    // out (MR x NR, row-major) = a panel times b panel over kc
+    template<typename T>
+    void kernel(uint64_t kc,const T* a,const T* b,T* out){
+        using P = pack<T>;
+        constexpr uint64_t W = P::width;
+        constexpr uint64_t NR = tile<T>::NR;
+        typename P::reg acc[MR][2];
+        for(uint64_t r = 0;r<MR;r++){
+            acc[r][0] = P::zero();
+            acc[r][1] = P::zero();
+        }
+        for(uint64_t k = 0;k<kc;k++){
+            typename P::reg b0 = P::load(b+k*NR);
+            typename P::reg b1 = P::load(b+k*NR+W);
+            for(uint64_t r = 0;r<MR;r++){
+                typename P::reg ar = P::set1(a[k*MR+r]);
+                acc[r][0] = P::add(acc[r][0],P::mul(ar,b0));
+                acc[r][1] = P::add(acc[r][1],P::mul(ar,b1));
+            }
+        }
+        for(uint64_t r = 0;r<MR;r++){
+            P::store(out+r*NR,acc[r][0]);
+            P::store(out+r*NR+W,acc[r][1]);
+        }
+    }
+
+    template<typename V>
+    void check_rank(const V&){
+        static_assert(nd_rank<V>::value==2,"a matrix operand must be a 2-D expression");
+    }
+
+    // blocks smaller than the pool's worth run on the calling thread
+    inline void run(uint64_t count,uint64_t work,std::function<void(uint64_t)> const& fn,epl::thread_pool& pool){
+        if(count==1||work<parallel_work){
+            for(uint64_t c = 0;c<count;c++){
+                fn(c);
+            }
+            return;
+        }
+        pool.run(count,fn);
+    }
+}
+
+/*****************************gemm********************************/
+// c = alpha*a*b + beta*c; a is m x k, b is k x n, c is an m x n view that
+// must not overlap a or b
+template<typename T,typename A,typename B>
+void gemm(const Wrap<ndview<T,2>>& c,const Wrap<A>& a,const Wrap<B>& b,
+          typename ndview<T,2>::value_type alpha = T(1),typename ndview<T,2>::value_type beta = T(0),
+          epl::thread_pool& pool = epl::default_pool()){
+    gemm_detail::check_rank(a);
+    gemm_detail::check_rank(b);
+    uint64_t m = a.shape()[0],k = a.shape()[1],n = b.shape()[1];
+    if(b.shape()[0]!=k||c.shape()[0]!=m||c.shape()[1]!=n){
+        throw std::invalid_argument("gemm shapes do not match");
+    }
+    using namespace gemm_detail;
+    constexpr uint64_t NR = tile<T>::NR;
+    T* cp = c.data();
+    int64_t c0 = c.stride()[0],c1 = c.stride()[1];
+    auto at = [cp,c0,c1](uint64_t i,uint64_t j)->T&{
+        return cp[static_cast<int64_t>(i)*c0+static_cast<int64_t>(j)*c1];
+    };
+    for(uint64_t i = 0;i<m;i++){
+        for(uint64_t j = 0;j<n;j++){
+            at(i,j) = beta==T(0) ? T(0) : beta*at(i,j);
+        }
+    }
+    if(k==0||alpha==T(0)) return;
+
+    reader<T,Wrap<A>> ra{a};
+    reader<T,Wrap<B>> rb{b};
+    std::vector<T> bpack;
+    for(uint64_t j0 = 0;j0<n;j0 += NC){
+        uint64_t nc = std::min(NC,n-j0);
+        for(uint64_t p0 = 0;p0<k;p0 += KC){
+            uint64_t kc = std::min(KC,k-p0);
+            bpack.resize((nc+NR-1)/NR*NR*kc);
+            pack_b(bpack.data(),rb,p0,kc,j0,nc);
+            uint64_t blocks = (m+MC-1)/MC;
+            run(blocks,m*nc*kc,[&](uint64_t blk){
+                static thread_local std::vector<T> apack;
+                uint64_t i0 = blk*MC;
+                uint64_t mc = std::min(MC,m-i0);
+                apack.resize((mc+MR-1)/MR*MR*kc);
+                pack_a(apack.data(),ra,i0,mc,p0,kc);
+                T out[MR*NR];
+                for(uint64_t jq = 0;jq*NR<nc;jq++){
+                    for(uint64_t iq = 0;iq*MR<mc;iq++){
+                        kernel(kc,apack.data()+iq*kc*MR,bpack.data()+jq*kc*NR,out);
+                        uint64_t rows = std::min(MR,mc-iq*MR);
+                        uint64_t cols = std::min(NR,nc-jq*NR);
+                        for(uint64_t r = 0;r<rows;r++){
+                            for(uint64_t s = 0;s<cols;s++){
+                                at(i0+iq*MR+r,j0+jq*NR+s) += alpha*out[r*NR+s];
+                            }
+                        }
+                    }
+                }
+            },pool);
+        }
+    }
+}
+
+/*****************************gemv********************************/
+// y = alpha*a*x + beta*y; a is m x n, x any 1-D expression of length n,
+// y holds at least m elements; x is evaluated once up front
+template<typename T,typename A,typename X>
+void gemv(vector<T>& y,const Wrap<A>& a,const Wrap<X>& x,
+          typename vector<T>::value_type alpha = T(1),typename vector<T>::value_type beta = T(0),
+          epl::thread_pool& pool = epl::default_pool()){
+    gemm_detail::check_rank(a);
+    uint64_t m = a.shape()[0],n = a.shape()[1];
+    if(x.size()!=n||y.size()<m){
+        throw std::invalid_argument("gemv shapes do not match");
+    }
+    if(m==0) return;
+    std::vector<T> xs(n);
+    for(uint64_t j = 0;j<n;j++){
+        xs[j] = static_cast<T>(x[j]);
+    }
+    gemm_detail::reader<T,Wrap<A>> ra{a};
+    T* yp = &y[0];
+    const T* xp = xs.data();
+    uint64_t count = std::min(epl::parallel_detail::chunk_count(m*n,pool),m);
+    gemm_detail::run(count,m*n,[&](uint64_t c){
+        uint64_t b = epl::parallel_detail::chunk_begin(c,count,m);
+        uint64_t e = epl::parallel_detail::chunk_begin(c+1,count,m);
+        for(uint64_t i = b;i<e;i++){
+            T acc = ra.row_dot(i,xp,n);
+            yp[i] = alpha*acc + (beta==T(0) ? T(0) : beta*yp[i]);
+        }
+    },pool);
+}
+
+/*****************************matmul********************************/
+// the m x n product as a fresh row-major valarray; view<2>(r,{m,n}) to
+// keep treating it as a matrix
+template<typename A,typename B>
+valarray<ChooseType<typename A::value_type,typename B::value_type>> matmul(const Wrap<A>& a,const Wrap<B>& b,
+                                                                            epl::thread_pool& pool = epl::default_pool()){
+    using R = ChooseType<typename A::value_type,typename B::value_type>;
+    gemm_detail::check_rank(a);
+    gemm_detail::check_rank(b);
+    valarray<R> r(a.shape()[0]*b.shape()[1]);
+    gemm(view<2>(r,nd_shape<2>{a.shape()[0],b.shape()[1]}),a,b,R(1),R(0),pool);
+    return r;
+}
+
+#endif /* _linear_algebra_h */
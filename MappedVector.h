@@ -0,0 +1,219 @@
+// MappedVector.h -- epl::vector style array of trivially copyable T backed by an mmap'd file
+//
+// The file is nothing but the elements back to back, so opening it is O(1)
+// and several processes mapping the same file share it through the page
+// cache. POSIX only.
+//
+//   READ_ONLY      zero-copy view, writing through it faults
+//   COPY_ON_WRITE  private mapping, writes stay in this process, fixed size
+//   READ_WRITE     shared mapping, writes reach the file, push_back grows
+//                  the file (capacity doubles) and remaps it; the file is
+//                  trimmed back to size() elements on close
+//
+// Bytes at the end of the file that do not make a whole element are not
+// part of the vector. A READ_WRITE mapping keeps them if its size never
+// changed; once it grows or shrinks, closing cuts the file to size()
+// whole elements and they are gone.
+
+#ifndef _mapped_vector_h
+#define _mapped_vector_h
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace epl{
+
+    enum MapMode {READ_ONLY,COPY_ON_WRITE,READ_WRITE};
+
+    template <typename T>
+    class mapped_vector {
+        static_assert(std::is_trivially_copyable<T>::value,"mapped_vector needs trivially copyable elements");
+
+    private:
+        int fd;
+        MapMode mode;
+        uint64_t len;
+        uint64_t capacity;      // elements the mapping (and the file) can hold
+        T* data;
+        uint64_t opened;        // elements in the file when it was opened
+        bool resized;           // the file was grown, so close has to trim it
+
+        static constexpr uint64_t first_capacity = 1024;
+
+    public:
+        // create == true truncates or creates the file, READ_WRITE only
+        mapped_vector(const char* path,MapMode m,bool create = false)
+            :fd(-1),mode(m),len(0),capacity(0),data(nullptr),opened(0),resized(false){
+            if(create&&mode!=READ_WRITE){
+                throw std::invalid_argument("only a READ_WRITE mapping can create its file");
+            }
+            int flags = (mode==READ_WRITE) ? O_RDWR : O_RDONLY;
+            if(create) flags |= O_CREAT|O_TRUNC;
+            fd = ::open(path,flags,0644);
+            if(fd<0){
+                throw std::system_error(errno,std::generic_category(),"open");
+            }
+            struct stat st;
+            if(::fstat(fd,&st)!=0){
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err,std::generic_category(),"fstat");
+            }
+            len = static_cast<uint64_t>(st.st_size)/sizeof(T);
+            opened = len;
+            try{
+                map(len);
+            }catch(...){
+                ::close(fd);
+                throw;
+            }
+        }
+
+        mapped_vector(mapped_vector const&) = delete;
+        mapped_vector& operator=(mapped_vector const&) = delete;
+
+        /*********************move construcot and assignment**************************/
+        mapped_vector(mapped_vector&& that) noexcept{
+            my_move(std::move(that));
+        }
+
+        mapped_vector& operator=(mapped_vector&& rhs) noexcept{
+            if(this!=&rhs){
+                destroy();
+                my_move(std::move(rhs));
+            }
+            return *this;
+        }
+
+        ~mapped_vector(void){
+            destroy();
+        }
+
+        uint64_t size(void) const{ return len; }
+        MapMode map_mode(void) const{ return mode; }
+
+        T& operator[](uint64_t k){
+            if(k>=len){
+                throw std::out_of_range("subscript ouf of range");
+            }
+            return data[k];
+        }
+
+        const T& operator[](uint64_t k) const{
+            if(k>=len){
+                throw std::out_of_range("subscript ouf of range");
+            }
+            return data[k];
+        }
+
+        T* begin(void){ return data; }
+        T* end(void){ return data+len; }
+        const T* begin(void) const{ return data; }
+        const T* end(void) const{ return data+len; }
+
+        /*********************growth, READ_WRITE only**************************/
+        void push_back(T const& val){
+            if(mode!=READ_WRITE){
+                throw std::logic_error("only a READ_WRITE mapping can grow");
+            }
+            if(len==capacity){
+                T tmp = val;    // val may point into the old mapping
+                remap(capacity==0 ? first_capacity : capacity*2);
+                data[len++] = tmp;
+                return;
+            }
+            data[len++] = val;
+        }
+
+        void pop_back(void){
+            if(len==0){
+                throw std::out_of_range("there is no element for being poped");
+            }
+            len--;
+        }
+
+        // write dirty pages of a READ_WRITE mapping back to the file
+        void flush(void){
+            if(mode==READ_WRITE&&data!=nullptr&&::msync(data,capacity*sizeof(T),MS_SYNC)!=0){
+                throw std::system_error(errno,std::generic_category(),"msync");
+            }
+        }
+
+    private:
+        // a new view of the first n elements; nothing is changed if it fails
+        T* view(uint64_t n){
+            if(n==0) return nullptr;
+            int prot = (mode==READ_ONLY) ? PROT_READ : PROT_READ|PROT_WRITE;
+            int flags = (mode==COPY_ON_WRITE) ? MAP_PRIVATE : MAP_SHARED;
+            void* p = ::mmap(nullptr,n*sizeof(T),prot,flags,fd,0);
+            if(p==MAP_FAILED){
+                throw std::system_error(errno,std::generic_category(),"mmap");
+            }
+            return static_cast<T*>(p);
+        }
+
+        void map(uint64_t n){
+            data = view(n);
+            capacity = n;
+        }
+
+        void unmap(void){
+            if(data!=nullptr) ::munmap(data,capacity*sizeof(T));
+            data = nullptr;
+            capacity = 0;
+        }
+
+        // the file is grown and the new view mapped while the old one is
+        // still in place, so on failure the vector is left as it was (the
+        // file may stay longer, close trims it)
+        void remap(uint64_t n){
+            if(::ftruncate(fd,static_cast<off_t>(n*sizeof(T)))!=0){
+                throw std::system_error(errno,std::generic_category(),"ftruncate");
+            }
+            resized = true;
+            T* p = view(n);
+            unmap();
+            data = p;
+            capacity = n;
+        }
+
+        void my_move(mapped_vector&& tmp){
+            fd = tmp.fd;
+            mode = tmp.mode;
+            len = tmp.len;
+            capacity = tmp.capacity;
+            data = tmp.data;
+            opened = tmp.opened;
+            resized = tmp.resized;
+
+            tmp.fd = -1;
+            tmp.len = 0;
+            tmp.capacity = 0;
+            tmp.data = nullptr;
+        }
+
+        void destroy(void){
+            if(fd<0) return;
+            unmap();
+            if(mode==READ_WRITE&&(resized||len!=opened)){
+                // drop the unused tail that growth left in the file
+                int ignored = ::ftruncate(fd,static_cast<off_t>(len*sizeof(T)));
+                (void)ignored;
+            }
+            ::close(fd);
+            fd = -1;
+        }
+    };
+
+} //namespace epl
+
+#endif /* _mapped_vector_h */
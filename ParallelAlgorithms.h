@@ -0,0 +1,281 @@
+// ParallelAlgorithms.h -- multithreaded for_each/transform/reduce/sort over epl::vector
+//
+// #include "Vector.h" before this file, the same way as for Valarray.h.
+//
+// The algorithms take the vector itself rather than iterators: the live
+// elements are the contiguous span [dstart, dend), so it is cut into chunks
+// and each chunk is handed to the pool as a plain pointer range. Instead of
+// paying check_invalid() on every iterator step, each chunk checks once
+// that the vector has not been modified since the algorithm started.
+
+#ifndef _parallel_algorithms_h
+#define _parallel_algorithms_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace epl{
+
+    /*********************thread pool**************************/
+    // workers pull chunk numbers from a shared counter, so a worker that
+    // finishes early keeps taking chunks from the slower ones
+    class thread_pool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex m;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        std::mutex run_lock;            // one job at a time
+
+        const std::function<void(uint64_t)>* job;
+        uint64_t chunks;
+        std::atomic<uint64_t> next;
+        uint64_t generation;
+        uint64_t active;
+        bool stop;
+        std::exception_ptr error;
+
+    public:
+        explicit thread_pool(unsigned n = std::thread::hardware_concurrency())
+            :job(nullptr),chunks(0),next(0),generation(0),active(0),stop(false){
+            // the calling thread works too
+            for(unsigned k = 1;k<n;k++){
+                workers.emplace_back([this]{ work(); });
+            }
+        }
+
+        thread_pool(thread_pool const&) = delete;
+        thread_pool& operator=(thread_pool const&) = delete;
+
+        ~thread_pool(void){
+            {
+                std::lock_guard<std::mutex> g(m);
+                stop = true;
+            }
+            wake.notify_all();
+            for(auto& t : workers){
+                t.join();
+            }
+        }
+
+        uint64_t threads(void) const{ return workers.size()+1; }
+
+        // calls fn(0) .. fn(n-1) across the pool and returns when all are done;
+        // the first exception thrown by fn is rethrown here. Called from
+        // inside one of this pool's jobs, it runs fn on the calling thread
+        void run(uint64_t n,std::function<void(uint64_t)> const& fn){
+            if(running()==this){
+                for(uint64_t c = 0;c<n;c++){
+                    fn(c);
+                }
+                return;
+            }
+            std::lock_guard<std::mutex> serial(run_lock);
+            {
+                std::lock_guard<std::mutex> g(m);
+                job = &fn;
+                chunks = n;
+                next.store(0);
+                error = nullptr;
+                active = workers.size();
+                generation++;
+            }
+            wake.notify_all();
+            claim(fn,n);
+            std::unique_lock<std::mutex> g(m);
+            finished.wait(g,[this]{ return active==0; });
+            job = nullptr;
+            if(error) std::rethrow_exception(error);
+        }
+
+    private:
+        // the pool whose job this thread is running, if any
+        static const thread_pool*& running(void){
+            static thread_local const thread_pool* pool = nullptr;
+            return pool;
+        }
+
+        void work(void){
+            uint64_t seen = 0;
+            for(;;){
+                const std::function<void(uint64_t)>* fn;
+                uint64_t n;
+                {
+                    std::unique_lock<std::mutex> g(m);
+                    wake.wait(g,[&]{ return stop||generation!=seen; });
+                    if(stop) return;
+                    seen = generation;
+                    fn = job;
+                    n = chunks;
+                }
+                claim(*fn,n);
+                std::lock_guard<std::mutex> g(m);
+                if(--active==0) finished.notify_one();
+            }
+        }
+
+        void claim(std::function<void(uint64_t)> const& fn,uint64_t n){
+            struct mark{
+                const thread_pool* outer;
+                explicit mark(const thread_pool* p):outer(running()){ running() = p; }
+                ~mark(void){ running() = outer; }
+            } in_job{this};
+            for(uint64_t c = next.fetch_add(1);c<n;c = next.fetch_add(1)){
+                try{
+                    fn(c);
+                }catch(...){
+                    std::lock_guard<std::mutex> g(m);
+                    if(!error) error = std::current_exception();
+                    next.store(n);      // stop handing out chunks
+                }
+            }
+        }
+    };
+
+    inline thread_pool& default_pool(void){
+        static thread_pool pool;
+        return pool;
+    }
+
+    inline uint64_t parallel_grain = 4096;     // smallest chunk worth a task
+
+    namespace parallel_detail{
+        // a few chunks per thread so that uneven work balances out
+        inline uint64_t chunk_count(uint64_t n,thread_pool& pool){
+            uint64_t most = pool.threads()*4;
+            uint64_t count = (n+parallel_grain-1)/parallel_grain;
+            if(count>most) count = most;
+            return count==0 ? 1 : count;
+        }
+        // chunk c covers [chunk_begin(c), chunk_begin(c+1)) of n elements
+        inline uint64_t chunk_begin(uint64_t c,uint64_t count,uint64_t n){
+            return n/count*c + (c<n%count ? c : n%count);
+        }
+
+        template <typename V>
+        void check_unchanged(V const& v,uint64_t version){
+            if(v.version()!=version){
+                throw epl::invalid_iterator{ epl::invalid_iterator::MODERATE };
+            }
+        }
+    }
+
+    /*********************for_each**************************/
+    template <typename T,typename F>
+    void parallel_for_each(vector<T>& v,F f,thread_pool& pool = default_pool()){
+        uint64_t n = v.size();
+        if(n==0) return;
+        T* base = &v[0];
+        uint64_t version = v.version();
+        uint64_t count = parallel_detail::chunk_count(n,pool);
+        pool.run(count,[&](uint64_t c){
+            parallel_detail::check_unchanged(v,version);
+            uint64_t b = parallel_detail::chunk_begin(c,count,n);
+            uint64_t e = parallel_detail::chunk_begin(c+1,count,n);
+            for(uint64_t k = b;k<e;k++){
+                f(base[k]);
+            }
+        });
+    }
+
+    /*********************transform**************************/
+    // out must already hold at least in.size() elements
+    template <typename T,typename U,typename F>
+    void parallel_transform(vector<T> const& in,vector<U>& out,F f,thread_pool& pool = default_pool()){
+        uint64_t n = in.size();
+        if(out.size()<n){
+            throw std::out_of_range("transform destination is too short");
+        }
+        if(n==0) return;
+        const T* src = &in[0];
+        U* dst = &out[0];
+        uint64_t in_version = in.version();
+        uint64_t out_version = out.version();
+        uint64_t count = parallel_detail::chunk_count(n,pool);
+        pool.run(count,[&](uint64_t c){
+            parallel_detail::check_unchanged(in,in_version);
+            parallel_detail::check_unchanged(out,out_version);
+            uint64_t b = parallel_detail::chunk_begin(c,count,n);
+            uint64_t e = parallel_detail::chunk_begin(c+1,count,n);
+            for(uint64_t k = b;k<e;k++){
+                dst[k] = f(src[k]);
+            }
+        });
+    }
+
+    /*********************reduce**************************/
+    // op must be associative, chunk results are combined left to right
+    template <typename T,typename R,typename Op>
+    R parallel_reduce(vector<T> const& v,R init,Op op,thread_pool& pool = default_pool()){
+        uint64_t n = v.size();
+        if(n==0) return init;
+        const T* base = &v[0];
+        uint64_t version = v.version();
+        uint64_t count = parallel_detail::chunk_count(n,pool);
+        std::vector<R> partial(count,init);
+        std::vector<char> used(count,0);
+        pool.run(count,[&](uint64_t c){
+            parallel_detail::check_unchanged(v,version);
+            uint64_t b = parallel_detail::chunk_begin(c,count,n);
+            uint64_t e = parallel_detail::chunk_begin(c+1,count,n);
+            if(b==e) return;
+            R acc = base[b];
+            for(uint64_t k = b+1;k<e;k++){
+                acc = op(acc,base[k]);
+            }
+            partial[c] = acc;
+            used[c] = 1;
+        });
+        R result = init;
+        for(uint64_t c = 0;c<count;c++){
+            if(used[c]) result = op(result,partial[c]);
+        }
+        return result;
+    }
+
+    template <typename T>
+    T parallel_reduce(vector<T> const& v,thread_pool& pool = default_pool()){
+        return parallel_reduce(v,T{},std::plus<T>{},pool);
+    }
+
+    /*********************sort**************************/
+    // chunks are sorted independently, then merged pairwise level by level
+    template <typename T,typename Comp = std::less<T>>
+    void parallel_sort(vector<T>& v,Comp comp = Comp{},thread_pool& pool = default_pool()){
+        uint64_t n = v.size();
+        if(n<2) return;
+        T* base = &v[0];
+        uint64_t version = v.version();
+        uint64_t count = parallel_detail::chunk_count(n,pool);
+        pool.run(count,[&](uint64_t c){
+            parallel_detail::check_unchanged(v,version);
+            std::sort(base+parallel_detail::chunk_begin(c,count,n),
+                      base+parallel_detail::chunk_begin(c+1,count,n),comp);
+        });
+        for(uint64_t width = 1;width<count;width *= 2){
+            uint64_t pairs = (count+2*width-1)/(2*width);
+            pool.run(pairs,[&](uint64_t p){
+                parallel_detail::check_unchanged(v,version);
+                uint64_t lo = 2*width*p;
+                uint64_t mid = lo+width;
+                uint64_t hi = mid+width;
+                if(mid>=count) return;
+                if(hi>count) hi = count;
+                std::inplace_merge(base+parallel_detail::chunk_begin(lo,count,n),
+                                   base+parallel_detail::chunk_begin(mid,count,n),
+                                   base+parallel_detail::chunk_begin(hi,count,n),comp);
+            });
+        }
+    }
+
+} //namespace epl
+
+#endif /* _parallel_algorithms_h */
@@ -0,0 +1,271 @@
+// RingBuffer.h -- fixed capacity ring buffer for producer/consumer pipelines
+//
+// Goes back to the wraparound indexing of the original Vector.h
+// (index = k + start; if(index>=capacity) index -= capacity) instead of the
+// linear gap used by VectorPhaseC2.h. The buffer is allocated once in the
+// constructor and never reallocated.
+
+#ifndef _ring_buffer_h
+#define _ring_buffer_h
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace epl{
+
+    // what push_back does when the buffer is already full
+    enum RingPolicy {REJECT_WHEN_FULL,OVERWRITE_OLDEST};
+
+    template <typename T,RingPolicy policy = REJECT_WHEN_FULL>
+    class ring_buffer {
+    private:
+        uint64_t len;
+        uint64_t cap;
+        T* data;
+        uint64_t start;     // oldest element
+        uint64_t myend;     // one past the newest element, wrapped
+
+    public:
+        // a contiguous piece of the buffer, at most two of them cover it
+        struct segment{
+            T* ptr;
+            uint64_t len;
+        };
+
+        explicit ring_buffer(uint64_t n){
+            if(n==0){
+                throw std::invalid_argument("ring_buffer needs a capacity");
+            }
+            len = 0;
+            cap = n;
+            data = reinterpret_cast<T*> (operator new(sizeof(T)*cap));
+            start = 0;
+            myend = 0;
+        }
+
+        /*********************copy construcot and assignment**************************/
+        ring_buffer(ring_buffer const& that){
+            copy(that);
+        }
+
+        ring_buffer& operator=(ring_buffer const& rhs){
+            if(this!=&rhs){
+                destroy();
+                copy(rhs);
+            }
+            return *this;
+        }
+
+        /*********************move construcot and assignment**************************/
+        ring_buffer(ring_buffer&& that) noexcept{
+            my_move(std::move(that));
+        }
+
+        ring_buffer& operator=(ring_buffer&& rhs) noexcept{
+            if(this!=&rhs){
+                destroy();
+                my_move(std::move(rhs));
+            }
+            return *this;
+        }
+
+        ~ring_buffer(void){
+            destroy();
+        }
+
+        uint64_t size(void) const{ return len; }
+        uint64_t capacity(void) const{ return cap; }
+        bool empty(void) const{ return len==0; }
+        bool full(void) const{ return len==cap; }
+
+        T& operator[](uint64_t k){
+            if(k>=len){
+                throw std::out_of_range("subscript ouf of range");
+            }
+            return data[wrap(start+k)];
+        }
+
+        const T& operator[](uint64_t k) const{
+            if(k>=len){
+                throw std::out_of_range("subscript ouf of range");
+            }
+            return data[wrap(start+k)];
+        }
+
+        T& front(void){ return (*this)[0]; }
+        T& back(void){ return (*this)[len-1]; }
+
+        /*********************push / pop**************************/
+        // false when the buffer is full and the policy is REJECT_WHEN_FULL
+        bool push_back(T const& val){ return emplace_back(val); }
+        bool push_back(T&& val){ return emplace_back(std::move(val)); }
+
+        template<typename... Args>
+        bool emplace_back(Args&&... args){
+            if(len==cap){
+                if(policy==REJECT_WHEN_FULL||cap==0) return false;
+                data[myend] = T{std::forward<Args>(args)...};  // myend == start when full
+                myend = wrap(myend+1);
+                start = myend;
+                return true;
+            }
+            new (data+myend) T{std::forward<Args>(args)...};
+            myend = wrap(myend+1);
+            len++;
+            return true;
+        }
+
+        void pop_front(void){
+            if(len==0){
+                throw std::out_of_range("there is no element for being poped");
+            }
+            (data+start)->~T();
+            start = wrap(start+1);
+            len--;
+        }
+
+        /*********************two segment access**************************/
+        // elements in order: first_segment() then second_segment()
+        segment first_segment(void){
+            uint64_t n = (len < cap-start) ? len : cap-start;
+            return segment{data+start,n};
+        }
+        segment second_segment(void){
+            uint64_t n = first_segment().len;
+            return segment{data,len-n};
+        }
+
+        // free slots in order, only for trivially copyable T, fill then commit()
+        segment first_free(void){
+            uint64_t room = cap-len;
+            uint64_t n = (room < cap-myend) ? room : cap-myend;
+            return segment{data+myend,n};
+        }
+        segment second_free(void){
+            uint64_t n = first_free().len;
+            return segment{data,cap-len-n};
+        }
+
+        void commit(uint64_t n){
+            static_assert(std::is_trivially_copyable<T>::value,"commit() needs trivially copyable elements");
+            if(n>cap-len){
+                throw std::out_of_range("commit past the free space");
+            }
+            myend = wrap(myend+n);
+            len += n;
+        }
+
+        // drop the n oldest elements
+        void consume(uint64_t n){
+            if(n>len){
+                throw std::out_of_range("there is no element for being poped");
+            }
+            if(!std::is_trivially_destructible<T>::value){
+                for(uint64_t k = 0;k<n;k++){
+                    (data+wrap(start+k))->~T();
+                }
+            }
+            start = wrap(start+n);
+            len -= n;
+        }
+
+        /*********************bulk copy in and out**************************/
+        // returns how many of the n values were taken
+        uint64_t write(const T* src,uint64_t n){
+            if(n>cap-len){
+                if(policy==REJECT_WHEN_FULL){
+                    n = cap-len;
+                }else{
+                    if(n>cap){          // only the newest cap values survive
+                        src += n-cap;
+                        n = cap;
+                    }
+                    consume(n-(cap-len));
+                }
+            }
+            segment a = first_free();
+            uint64_t na = (n < a.len) ? n : a.len;
+            put(a.ptr,src,na);
+            put(data,src+na,n-na);
+            myend = wrap(myend+n);
+            len += n;
+            return n;
+        }
+
+        // moves up to n of the oldest values into dst and pops them
+        uint64_t read(T* dst,uint64_t n){
+            if(n>len) n = len;
+            segment a = first_segment();
+            uint64_t na = (n < a.len) ? n : a.len;
+            take(dst,a.ptr,na);
+            take(dst+na,data,n-na);
+            consume(n);
+            return n;
+        }
+
+    private:
+        uint64_t wrap(uint64_t index) const{
+            if(index>=cap) index -= cap;
+            return index;
+        }
+
+        void put(T* to,const T* from,uint64_t n){
+            if(std::is_trivially_copyable<T>::value){
+                if(n) std::memcpy(static_cast<void*>(to),from,n*sizeof(T));
+            }else{
+                for(uint64_t k = 0;k<n;k++){
+                    new (to+k) T{from[k]};
+                }
+            }
+        }
+
+        void take(T* to,T* from,uint64_t n){
+            if(std::is_trivially_copyable<T>::value){
+                if(n) std::memcpy(static_cast<void*>(to),from,n*sizeof(T));
+            }else{
+                for(uint64_t k = 0;k<n;k++){
+                    to[k] = std::move(from[k]);
+                }
+            }
+        }
+
+        void copy(ring_buffer const& that){
+            len = 0;
+            cap = that.cap;
+            data = reinterpret_cast<T*> (operator new(sizeof(T)*cap));
+            start = 0;
+            myend = 0;
+            for(uint64_t k = 0;k<that.len;k++){
+                emplace_back(that[k]);
+            }
+        }
+
+        void my_move(ring_buffer&& tmp){
+            data = tmp.data;
+            len = tmp.len;
+            cap = tmp.cap;
+            start = tmp.start;
+            myend = tmp.myend;
+
+            tmp.data = nullptr;
+            tmp.len = 0;
+            tmp.cap = 0;
+            tmp.start = 0;
+            tmp.myend = 0;
+        }
+
+        void destroy(void){
+            for(uint64_t k = 0;k<len;k++){
+                (data+wrap(start+k))->~T();
+            }
+            operator delete (data);
+        }
+    };
+
+} //namespace epl
+
+#endif /* _ring_buffer_h */
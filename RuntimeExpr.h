@@ -0,0 +1,748 @@
+// RuntimeExpr.h -- valarray expressions composed at run time, run as block bytecode
+//
+// #include "Vector.h" and "Valarray.h" before this file.
+//
+// Every expression built with expr_builder, or parsed from text, has the
+// same type dynamic_expr<T> whatever its shape, so nothing is instantiated
+// per expression. expr_program compiles the expression graph into a short
+// list of primitive kernels (add, mul, sqrt, ...) over registers of
+// `block` elements; registers are reused once their value is dead and
+// constant subtrees are folded. Running a program walks the inputs block
+// by block and every instruction is one packed loop over a block that
+// stays in L1, so dispatch costs one switch per instruction per block
+// rather than one per element.
+//
+//     expr_builder<double> b;
+//     b.input("x"); b.input("y");
+//     expr_program<double> p(b.parse("sqrt(x*x + y*y)*0.5"));
+//     valarray<double> r = p(x,y);
+
+#ifndef _runtime_expr_h
+#define _runtime_expr_h
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace runtime_detail{
+    // elements per register; a few registers of doubles fit L1 together
+    static constexpr uint64_t block = 256;
+
+    // madd is a*b+c; only the compiler emits it, for a mul feeding an add
+    enum class opcode:uint8_t{ add,sub,mul,div,min,max,neg,abs,sqrt,exp,log,madd };
+
+    inline bool is_unary(opcode op){ return op>=opcode::neg&&op<=opcode::log; }
+
+    /*****************************kernels********************************/
+    // one functor per opcode; packed ones run on simd_pack, the rest on
+    // scalar_pack, where reg is T itself
+    template<typename P> using reg = typename P::reg;
+
+    struct add_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a,reg<P> b){ return P::add(a,b); } };
+    struct sub_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a,reg<P> b){ return P::sub(a,b); } };
+    struct mul_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a,reg<P> b){ return P::mul(a,b); } };
+    struct div_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a,reg<P> b){ return P::div(a,b); } };
+    struct min_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a,reg<P> b){ return P::min(a,b); } };
+    struct max_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a,reg<P> b){ return P::max(a,b); } };
+    // times -1 rather than 0-a, so -0.0 comes out as the template path has it
+    struct neg_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a){ return P::mul(P::set1(-1),a); } };
+    struct sqrt_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a){ return P::sqrt(a); } };
+    struct abs_k{ static constexpr bool packed = false; template<typename P> static reg<P> apply(reg<P> a){ using std::abs; return abs(a); } };
+    struct exp_k{ static constexpr bool packed = false; template<typename P> static reg<P> apply(reg<P> a){ using std::exp; return exp(a); } };
+    struct log_k{ static constexpr bool packed = false; template<typename P> static reg<P> apply(reg<P> a){ using std::log; return log(a); } };
+    // rounded twice, like the two template nodes it replaces
+    struct madd_k{ static constexpr bool packed = true; template<typename P> static reg<P> apply(reg<P> a,reg<P> b,reg<P> c){ return P::add(P::mul(a,b),c); } };
+
+    template<typename F,typename T>
+    using pack_for = typename std::conditional<F::packed,simd_detail::simd_pack<T>,simd_detail::scalar_pack<T>>::type;
+
+    // a block operand: p[0..n), or the constant c when p is null
+    template<typename T>
+    struct source{
+        const T* p;
+        T c;
+    };
+
+    template<typename F,typename P,bool CA,bool CB,typename T>
+    void binary(T* out,const source<T>& a,const source<T>& b,uint64_t n){
+        using S = simd_detail::scalar_pack<T>;
+        constexpr uint64_t W = P::width;
+        reg<P> ca = P::set1(a.c),cb = P::set1(b.c);
+        uint64_t k = 0;
+        for(;k+W<=n;k += W){
+            P::store(out+k,F::template apply<P>(CA ? ca : P::load(a.p+k),CB ? cb : P::load(b.p+k)));
+        }
+        for(;k<n;k++){
+            out[k] = F::template apply<S>(CA ? a.c : a.p[k],CB ? b.c : b.p[k]);
+        }
+    }
+    // both constant never gets here, the builder folds it
+    template<typename F,typename T>
+    void binary(T* out,const source<T>& a,const source<T>& b,uint64_t n){
+        using P = pack_for<F,T>;
+        if(a.p==nullptr){
+            binary<F,P,true,false>(out,a,b,n);
+        }else if(b.p==nullptr){
+            binary<F,P,false,true>(out,a,b,n);
+        }else{
+            binary<F,P,false,false>(out,a,b,n);
+        }
+    }
+
+    template<typename F,typename P,bool CA,bool CB,bool CC,typename T>
+    void ternary(T* out,const source<T>& a,const source<T>& b,const source<T>& c,uint64_t n){
+        using S = simd_detail::scalar_pack<T>;
+        constexpr uint64_t W = P::width;
+        reg<P> ca = P::set1(a.c),cb = P::set1(b.c),cc = P::set1(c.c);
+        uint64_t k = 0;
+        for(;k+W<=n;k += W){
+            P::store(out+k,F::template apply<P>(CA ? ca : P::load(a.p+k),CB ? cb : P::load(b.p+k),CC ? cc : P::load(c.p+k)));
+        }
+        for(;k<n;k++){
+            out[k] = F::template apply<S>(CA ? a.c : a.p[k],CB ? b.c : b.p[k],CC ? c.c : c.p[k]);
+        }
+    }
+    template<typename F,typename T>
+    void ternary(T* out,const source<T>& a,const source<T>& b,const source<T>& c,uint64_t n){
+        using P = pack_for<F,T>;
+        switch((a.p==nullptr)|(b.p==nullptr)<<1|(c.p==nullptr)<<2){
+        case 0:  ternary<F,P,false,false,false>(out,a,b,c,n); break;
+        case 1:  ternary<F,P,true,false,false>(out,a,b,c,n); break;
+        case 2:  ternary<F,P,false,true,false>(out,a,b,c,n); break;
+        case 4:  ternary<F,P,false,false,true>(out,a,b,c,n); break;
+        case 5:  ternary<F,P,true,false,true>(out,a,b,c,n); break;
+        default: ternary<F,P,false,true,true>(out,a,b,c,n); break;
+        }
+    }
+
+    template<typename F,typename T>
+    void unary(T* out,const source<T>& a,uint64_t n){
+        using P = pack_for<F,T>;
+        using S = simd_detail::scalar_pack<T>;
+        constexpr uint64_t W = P::width;
+        uint64_t k = 0;
+        for(;k+W<=n;k += W){
+            P::store(out+k,F::template apply<P>(P::load(a.p+k)));
+        }
+        for(;k<n;k++){
+            out[k] = F::template apply<S>(a.p[k]);
+        }
+    }
+
+    // the dispatch table: one case per opcode, every kernel instantiated
+    // once per element type
+    template<typename T>
+    void exec(opcode op,T* out,const source<T>& a,const source<T>& b,const source<T>& c,uint64_t n){
+        switch(op){
+        case opcode::add:  binary<add_k>(out,a,b,n); break;
+        case opcode::sub:  binary<sub_k>(out,a,b,n); break;
+        case opcode::mul:  binary<mul_k>(out,a,b,n); break;
+        case opcode::div:  binary<div_k>(out,a,b,n); break;
+        case opcode::min:  binary<min_k>(out,a,b,n); break;
+        case opcode::max:  binary<max_k>(out,a,b,n); break;
+        case opcode::neg:  unary<neg_k>(out,a,n); break;
+        case opcode::abs:  unary<abs_k>(out,a,n); break;
+        case opcode::sqrt: unary<sqrt_k>(out,a,n); break;
+        case opcode::exp:  unary<exp_k>(out,a,n); break;
+        case opcode::log:  unary<log_k>(out,a,n); break;
+        case opcode::madd: ternary<madd_k>(out,a,b,c,n); break;
+        }
+    }
+
+    // the same operation on one element, for operator[] and constant folding
+    template<typename T>
+    T scalar(opcode op,T a,T b,T c = T(0)){
+        using S = simd_detail::scalar_pack<T>;
+        switch(op){
+        case opcode::add:  return add_k::apply<S>(a,b);
+        case opcode::sub:  return sub_k::apply<S>(a,b);
+        case opcode::mul:  return mul_k::apply<S>(a,b);
+        case opcode::div:  return div_k::apply<S>(a,b);
+        case opcode::min:  return min_k::apply<S>(a,b);
+        case opcode::max:  return max_k::apply<S>(a,b);
+        case opcode::neg:  return neg_k::apply<S>(a);
+        case opcode::abs:  return abs_k::apply<S>(a);
+        case opcode::sqrt: return sqrt_k::apply<S>(a);
+        case opcode::exp:  return exp_k::apply<S>(a);
+        case opcode::log:  return log_k::apply<S>(a);
+        case opcode::madd: return madd_k::apply<S>(a,b,c);
+        }
+        return a;
+    }
+
+    /*****************************expression graph********************************/
+    template<typename T>
+    struct graph{
+        enum kind_t:uint8_t{ input,constant,apply };
+        struct node{
+            kind_t kind;
+            opcode op;
+            uint32_t a,b;   // operand nodes of apply, the input number of input
+            T value;        // constant
+        };
+        std::vector<node> nodes;
+        std::vector<std::string> names;     // of the inputs, in order
+        std::vector<uint32_t> inputs;       // their nodes
+
+        uint32_t add(const node& n){
+            nodes.push_back(n);
+            return static_cast<uint32_t>(nodes.size()-1);
+        }
+        uint32_t make(opcode op,uint32_t a,uint32_t b){
+            bool folds = nodes[a].kind==constant&&(is_unary(op)||nodes[b].kind==constant);
+            if(folds){
+                return add(node{constant,op,0,0,scalar(op,nodes[a].value,is_unary(op) ? T(0) : nodes[b].value)});
+            }
+            return add(node{apply,op,a,b,T(0)});
+        }
+    };
+
+    /*****************************bytecode********************************/
+    static constexpr uint32_t out_reg = ~uint32_t(0);
+
+    template<typename T>
+    struct operand{
+        enum kind_t:uint8_t{ reg,input,constant };
+        kind_t kind;
+        uint32_t index;
+        T value;
+    };
+
+    template<typename T>
+    struct instr{
+        opcode op;
+        operand<T> a,b,c;   // as many as the opcode takes
+        uint32_t dst;       // a register, or out_reg for the result
+    };
+}
+
+template<typename T> class expr_builder;
+template<typename T> class expr_program;
+
+/*****************************dynamic_expr********************************/
+// a handle on a node of an expr_builder's graph; arithmetic on handles adds
+// nodes, so any expression built at run time has this one type
+template<typename T>
+class dynamic_expr{
+public:
+    using value_type = T;
+
+    dynamic_expr<T> apply(runtime_detail::opcode op) const{
+        return dynamic_expr<T>{g,g->make(op,id,id)};
+    }
+    dynamic_expr<T> apply(runtime_detail::opcode op,const dynamic_expr<T>& b) const{
+        if(g.get()!=b.g.get()){
+            throw std::invalid_argument("dynamic_expr operands come from different builders");
+        }
+        return dynamic_expr<T>{g,g->make(op,id,b.id)};
+    }
+    // c as a node of the same graph
+    dynamic_expr<T> constant(T c) const{
+        using graph = runtime_detail::graph<T>;
+        return dynamic_expr<T>{g,g->add(typename graph::node{graph::constant,runtime_detail::opcode::add,0,0,c})};
+    }
+
+private:
+    std::shared_ptr<runtime_detail::graph<T>> g;
+    uint32_t id;
+
+    dynamic_expr(std::shared_ptr<runtime_detail::graph<T>> graph,uint32_t node):g(std::move(graph)),id(node){}
+
+    friend class expr_builder<T>;
+    friend class expr_program<T>;
+};
+
+// the scalar side is value_type, so x*2 works for a dynamic_expr<double>
+template<typename T>
+using dynamic_scalar = typename dynamic_expr<T>::value_type;
+
+template<typename T>
+dynamic_expr<T> operator+(const dynamic_expr<T>& a,const dynamic_expr<T>& b){ return a.apply(runtime_detail::opcode::add,b); }
+template<typename T>
+dynamic_expr<T> operator+(const dynamic_expr<T>& a,dynamic_scalar<T> c){ return a+a.constant(c); }
+template<typename T>
+dynamic_expr<T> operator+(dynamic_scalar<T> c,const dynamic_expr<T>& b){ return b.constant(c)+b; }
+
+template<typename T>
+dynamic_expr<T> operator-(const dynamic_expr<T>& a,const dynamic_expr<T>& b){ return a.apply(runtime_detail::opcode::sub,b); }
+template<typename T>
+dynamic_expr<T> operator-(const dynamic_expr<T>& a,dynamic_scalar<T> c){ return a-a.constant(c); }
+template<typename T>
+dynamic_expr<T> operator-(dynamic_scalar<T> c,const dynamic_expr<T>& b){ return b.constant(c)-b; }
+
+template<typename T>
+dynamic_expr<T> operator*(const dynamic_expr<T>& a,const dynamic_expr<T>& b){ return a.apply(runtime_detail::opcode::mul,b); }
+template<typename T>
+dynamic_expr<T> operator*(const dynamic_expr<T>& a,dynamic_scalar<T> c){ return a*a.constant(c); }
+template<typename T>
+dynamic_expr<T> operator*(dynamic_scalar<T> c,const dynamic_expr<T>& b){ return b.constant(c)*b; }
+
+template<typename T>
+dynamic_expr<T> operator/(const dynamic_expr<T>& a,const dynamic_expr<T>& b){ return a.apply(runtime_detail::opcode::div,b); }
+template<typename T>
+dynamic_expr<T> operator/(const dynamic_expr<T>& a,dynamic_scalar<T> c){ return a/a.constant(c); }
+template<typename T>
+dynamic_expr<T> operator/(dynamic_scalar<T> c,const dynamic_expr<T>& b){ return b.constant(c)/b; }
+
+template<typename T>
+dynamic_expr<T> min(const dynamic_expr<T>& a,const dynamic_expr<T>& b){ return a.apply(runtime_detail::opcode::min,b); }
+template<typename T>
+dynamic_expr<T> min(const dynamic_expr<T>& a,dynamic_scalar<T> c){ return min(a,a.constant(c)); }
+template<typename T>
+dynamic_expr<T> min(dynamic_scalar<T> c,const dynamic_expr<T>& b){ return min(b.constant(c),b); }
+
+template<typename T>
+dynamic_expr<T> max(const dynamic_expr<T>& a,const dynamic_expr<T>& b){ return a.apply(runtime_detail::opcode::max,b); }
+template<typename T>
+dynamic_expr<T> max(const dynamic_expr<T>& a,dynamic_scalar<T> c){ return max(a,a.constant(c)); }
+template<typename T>
+dynamic_expr<T> max(dynamic_scalar<T> c,const dynamic_expr<T>& b){ return max(b.constant(c),b); }
+
+template<typename T>
+dynamic_expr<T> operator-(const dynamic_expr<T>& a){ return a.apply(runtime_detail::opcode::neg); }
+template<typename T>
+dynamic_expr<T> abs(const dynamic_expr<T>& a){ return a.apply(runtime_detail::opcode::abs); }
+template<typename T>
+dynamic_expr<T> sqrt(const dynamic_expr<T>& a){ return a.apply(runtime_detail::opcode::sqrt); }
+template<typename T>
+dynamic_expr<T> exp(const dynamic_expr<T>& a){ return a.apply(runtime_detail::opcode::exp); }
+template<typename T>
+dynamic_expr<T> log(const dynamic_expr<T>& a){ return a.apply(runtime_detail::opcode::log); }
+
+/*****************************parser********************************/
+namespace runtime_detail{
+    // recursive descent over
+    //   expr    := term (('+'|'-') term)*
+    //   term    := unary (('*'|'/') unary)*
+    //   unary   := ('-'|'+') unary | primary
+    //   primary := number | input | name '(' expr (',' expr)* ')' | '(' expr ')'
+    // with the functions sqrt, abs, exp, log, min and max
+    template<typename T>
+    struct parser{
+        graph<T>& g;
+        const std::string& s;
+        size_t pos;
+
+        parser(graph<T>& target,const std::string& text):g(target),s(text),pos(0){}
+
+        [[noreturn]] void fail(const std::string& what) const{
+            throw std::invalid_argument("expression: "+what+" at position "+std::to_string(pos));
+        }
+        void skip(){
+            while(pos<s.size()&&std::isspace(static_cast<unsigned char>(s[pos]))) pos++;
+        }
+        bool eat(char c){
+            skip();
+            if(pos<s.size()&&s[pos]==c){
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        uint32_t parse(){
+            uint32_t a = expr();
+            skip();
+            if(pos!=s.size()) fail(std::string("unexpected '")+s[pos]+"'");
+            return a;
+        }
+        uint32_t expr(){
+            uint32_t a = term();
+            for(;;){
+                if(eat('+')) a = g.make(opcode::add,a,term());
+                else if(eat('-')) a = g.make(opcode::sub,a,term());
+                else return a;
+            }
+        }
+        uint32_t term(){
+            uint32_t a = unary();
+            for(;;){
+                if(eat('*')) a = g.make(opcode::mul,a,unary());
+                else if(eat('/')) a = g.make(opcode::div,a,unary());
+                else return a;
+            }
+        }
+        uint32_t unary(){
+            if(eat('-')){
+                uint32_t a = unary();
+                return g.make(opcode::neg,a,a);
+            }
+            if(eat('+')) return unary();
+            return primary();
+        }
+        uint32_t primary(){
+            if(eat('(')){
+                uint32_t a = expr();
+                if(!eat(')')) fail("expected ')'");
+                return a;
+            }
+            skip();
+            if(pos<s.size()&&(std::isdigit(static_cast<unsigned char>(s[pos]))||s[pos]=='.')){
+                const char* b = s.c_str()+pos;
+                char* e = nullptr;
+                long double v = std::strtold(b,&e);
+                if(e==b) fail("bad number");
+                pos += static_cast<size_t>(e-b);
+                return g.add(typename graph<T>::node{graph<T>::constant,opcode::add,0,0,static_cast<T>(v)});
+            }
+            if(pos<s.size()&&(std::isalpha(static_cast<unsigned char>(s[pos]))||s[pos]=='_')){
+                size_t b = pos;
+                while(pos<s.size()&&(std::isalnum(static_cast<unsigned char>(s[pos]))||s[pos]=='_')) pos++;
+                std::string name = s.substr(b,pos-b);
+                if(eat('(')) return call(name,b);
+                for(uint64_t i = 0;i<g.names.size();i++){
+                    if(g.names[i]==name) return g.inputs[i];
+                }
+                pos = b;
+                fail("unknown input '"+name+"'");
+            }
+            fail("expected a number, an input or '('");
+        }
+        uint32_t call(const std::string& name,size_t at){
+            opcode op;
+            bool two = false;
+            if(name=="sqrt") op = opcode::sqrt;
+            else if(name=="abs") op = opcode::abs;
+            else if(name=="exp") op = opcode::exp;
+            else if(name=="log") op = opcode::log;
+            else if(name=="min"){ op = opcode::min; two = true; }
+            else if(name=="max"){ op = opcode::max; two = true; }
+            else{
+                pos = at;
+                fail("unknown function '"+name+"'");
+            }
+            uint32_t a = expr(),b = a;
+            if(two){
+                if(!eat(',')) fail(name+"() takes two arguments");
+                b = expr();
+            }
+            if(!eat(')')) fail("expected ')'");
+            return g.make(op,a,b);
+        }
+    };
+}
+
+/*****************************expr_builder********************************/
+// owns the graph the handles point into; inputs are numbered in the order
+// they are declared, which is the order a program takes its arguments in
+template<typename T>
+class expr_builder{
+public:
+    static_assert(std::is_floating_point<T>::value,"runtime expressions are over float, double or long double");
+
+    expr_builder():g(std::make_shared<runtime_detail::graph<T>>()){}
+
+    dynamic_expr<T> input(const std::string& name = std::string()){
+        using graph = runtime_detail::graph<T>;
+        if(!name.empty()&&std::find(g->names.begin(),g->names.end(),name)!=g->names.end()){
+            throw std::invalid_argument("input '"+name+"' is declared twice");
+        }
+        uint32_t id = g->add(typename graph::node{graph::input,runtime_detail::opcode::add,static_cast<uint32_t>(g->names.size()),0,T(0)});
+        g->names.push_back(name);
+        g->inputs.push_back(id);
+        return dynamic_expr<T>{g,id};
+    }
+    dynamic_expr<T> constant(T c){
+        using graph = runtime_detail::graph<T>;
+        return dynamic_expr<T>{g,g->add(typename graph::node{graph::constant,runtime_detail::opcode::add,0,0,c})};
+    }
+    // text over the named inputs declared so far; throws invalid_argument
+    // with the position of the first error
+    dynamic_expr<T> parse(const std::string& text){
+        return dynamic_expr<T>{g,runtime_detail::parser<T>(*g,text).parse()};
+    }
+    uint64_t inputs() const{ return g->names.size(); }
+
+private:
+    std::shared_ptr<runtime_detail::graph<T>> g;
+};
+
+/*****************************binding********************************/
+namespace runtime_detail{
+    // the input buffers of one call; anything but a plain vector<T> is
+    // evaluated into owned storage when the call is made
+    template<typename T>
+    struct binding{
+        std::vector<const T*> in;
+        std::vector<std::vector<T>> owned;
+        uint64_t n = 0;
+
+        template<typename V>
+        void add(const Wrap<V>& x){
+            static_assert(nd_rank<V>::value==0,"expression inputs are 1-D");
+            n = in.empty() ? x.size() : std::min<uint64_t>(n,x.size());
+            add(x,std::is_base_of<vector<T>,V>{});
+        }
+        template<typename V>
+        void add(const Wrap<V>& x,std::true_type /*plain*/){
+            in.push_back(x.size()==0 ? nullptr : &x[0]);
+        }
+        template<typename V>
+        void add(const Wrap<V>& x,std::false_type){
+            owned.emplace_back(x.size());
+            std::vector<T>& v = owned.back();
+            for(uint64_t k = 0;k<v.size();k++){
+                v[k] = static_cast<T>(x[k]);
+            }
+            in.push_back(v.data());
+        }
+    };
+}
+
+template<typename T> class ProgramProxy;
+
+/*****************************expr_program********************************/
+// the compiled form of a dynamic_expr; independent of the builder once made
+template<typename T>
+class expr_program{
+public:
+    explicit expr_program(const dynamic_expr<T>& e):ninputs(e.g->names.size()),nregs(0){
+        compile(*e.g,e.id);
+    }
+
+    uint64_t inputs() const{ return ninputs; }
+    uint64_t instructions() const{ return code.size(); }
+    uint64_t registers() const{ return nregs; }
+
+    // out[k] for k < n from the input buffers in[0..inputs()); out may be
+    // one of the inputs
+    void run(T* out,const T* const* in,uint64_t n) const{
+        using namespace runtime_detail;
+        if(code.empty()){
+            for(uint64_t k = 0;k<n;k++){
+                out[k] = result.kind==operand<T>::input ? in[result.index][k] : result.value;
+            }
+            return;
+        }
+        static thread_local std::vector<T> scratch;
+        scratch.resize(static_cast<uint64_t>(nregs)*block);
+        T* regs = scratch.data();
+        for(uint64_t b = 0;b<n;b += block){
+            uint64_t m = std::min(block,n-b);
+            for(const instr<T>& i:code){
+                T* dst = i.dst==out_reg ? out+b : regs+static_cast<uint64_t>(i.dst)*block;
+                exec(i.op,dst,fetch(i.a,regs,in,b),fetch(i.b,regs,in,b),fetch(i.c,regs,in,b),m);
+            }
+        }
+    }
+
+    // element k alone, interpreted one instruction at a time
+    T at(const T* const* in,uint64_t k) const{
+        using namespace runtime_detail;
+        if(code.empty()){
+            return result.kind==operand<T>::input ? in[result.index][k] : result.value;
+        }
+        static thread_local std::vector<T> vals;
+        vals.resize(nregs);
+        auto value = [&](const operand<T>& o){
+            return o.kind==operand<T>::reg ? vals[o.index] : o.kind==operand<T>::input ? in[o.index][k] : o.value;
+        };
+        T r = T(0);
+        for(const instr<T>& i:code){
+            T v = scalar(i.op,value(i.a),value(i.b),value(i.c));
+            if(i.dst==out_reg) r = v;
+            else vals[i.dst] = v;
+        }
+        return r;
+    }
+
+    // a lazy node over the inputs, as long as the shortest; plain
+    // valarray<T> inputs are read in place and must outlive it, as must
+    // the program
+    template<typename... Vs>
+    Wrap<ProgramProxy<T>> operator()(const Wrap<Vs>&... xs) const{
+        check(sizeof...(Vs));
+        auto b = std::make_shared<runtime_detail::binding<T>>();
+        b->owned.reserve(sizeof...(Vs));
+        (b->add(xs),...);
+        return Wrap<ProgramProxy<T>>{ProgramProxy<T>{*this,std::move(b)}};
+    }
+    // the same with the inputs counted at run time
+    Wrap<ProgramProxy<T>> operator()(const std::vector<const vector<T>*>& xs) const{
+        check(xs.size());
+        auto b = std::make_shared<runtime_detail::binding<T>>();
+        for(const vector<T>* x:xs){
+            b->add(static_cast<const Wrap<vector<T>>&>(*x));
+        }
+        return Wrap<ProgramProxy<T>>{ProgramProxy<T>{*this,std::move(b)}};
+    }
+
+private:
+    std::vector<runtime_detail::instr<T>> code;
+    runtime_detail::operand<T> result;      // where the value is when code is empty
+    uint64_t ninputs;
+    uint32_t nregs;
+
+    void check(uint64_t count) const{
+        if(count!=ninputs){
+            throw std::invalid_argument("expression takes "+std::to_string(ninputs)+" inputs, "+std::to_string(count)+" given");
+        }
+    }
+
+    static runtime_detail::source<T> fetch(const runtime_detail::operand<T>& o,const T* regs,const T* const* in,uint64_t b){
+        using operand = runtime_detail::operand<T>;
+        switch(o.kind){
+        case operand::reg:   return {regs+static_cast<uint64_t>(o.index)*runtime_detail::block,T(0)};
+        case operand::input: return {in[o.index]+b,T(0)};
+        default:             return {nullptr,o.value};
+        }
+    }
+
+    static runtime_detail::operand<T> ref(const runtime_detail::graph<T>& g,uint32_t id,const std::vector<uint32_t>& where){
+        using graph = runtime_detail::graph<T>;
+        using operand = runtime_detail::operand<T>;
+        const typename graph::node& n = g.nodes[id];
+        switch(n.kind){
+        case graph::input:    return operand{operand::input,n.a,T(0)};
+        case graph::constant: return operand{operand::constant,0,n.value};
+        default:              return operand{operand::reg,where[id],T(0)};
+        }
+    }
+
+    // operands first, each shared node once. A mul read only by an add is
+    // folded into it as one madd, which saves a pass over the block. A
+    // register is handed on as soon as the last instruction reading it has
+    // been emitted, and the root writes the output directly
+    void compile(const runtime_detail::graph<T>& g,uint32_t root){
+        using namespace runtime_detail;
+        using node = typename graph<T>::node;
+        auto is_apply = [&g](uint32_t id){ return g.nodes[id].kind==graph<T>::apply; };
+
+        std::vector<uint32_t> order;
+        std::vector<uint8_t> seen(g.nodes.size(),0);
+        std::vector<std::pair<uint32_t,bool>> stack{{root,false}};
+        while(!stack.empty()){
+            std::pair<uint32_t,bool> top = stack.back();
+            stack.pop_back();
+            const node& n = g.nodes[top.first];
+            if(!is_apply(top.first)||(seen[top.first]&&!top.second)) continue;
+            if(top.second){
+                order.push_back(top.first);
+                continue;
+            }
+            seen[top.first] = 1;
+            stack.push_back({top.first,true});
+            if(!is_unary(n.op)) stack.push_back({n.b,false});
+            stack.push_back({n.a,false});
+        }
+
+        // the operand nodes of every instruction, fused muls dropped
+        std::vector<uint32_t> uses(g.nodes.size(),0);
+        for(uint32_t id:order){
+            uses[g.nodes[id].a]++;
+            if(!is_unary(g.nodes[id].op)) uses[g.nodes[id].b]++;
+        }
+        auto fusable = [&](uint32_t id){
+            return is_apply(id)&&g.nodes[id].op==opcode::mul&&uses[id]==1;
+        };
+        struct step{
+            uint32_t id;
+            opcode op;
+            uint32_t args[3];
+            uint32_t count;
+        };
+        std::vector<step> steps;
+        std::vector<uint8_t> fused(g.nodes.size(),0);
+        for(uint32_t id:order){
+            const node& n = g.nodes[id];
+            if(n.op==opcode::add&&(fusable(n.a)||fusable(n.b))){
+                uint32_t m = fusable(n.a) ? n.a : n.b;
+                uint32_t other = m==n.a ? n.b : n.a;
+                fused[m] = 1;
+                steps.push_back(step{id,opcode::madd,{g.nodes[m].a,g.nodes[m].b,other},3});
+            }else if(is_unary(n.op)){
+                steps.push_back(step{id,n.op,{n.a,n.a,n.a},1});
+            }else{
+                steps.push_back(step{id,n.op,{n.a,n.b,n.b},2});
+            }
+        }
+        steps.erase(std::remove_if(steps.begin(),steps.end(),[&fused](const step& s){ return fused[s.id]!=0; }),steps.end());
+
+        std::vector<uint32_t> last(g.nodes.size(),0);
+        for(uint32_t i = 0;i<steps.size();i++){
+            for(uint32_t j = 0;j<steps[i].count;j++){
+                last[steps[i].args[j]] = i;
+            }
+        }
+        std::vector<uint32_t> where(g.nodes.size(),out_reg);
+        std::vector<uint32_t> spare;
+        for(uint32_t i = 0;i<steps.size();i++){
+            const step& s = steps[i];
+            instr<T> in;
+            in.op = s.op;
+            in.a = ref(g,s.args[0],where);
+            in.b = ref(g,s.args[1],where);
+            in.c = ref(g,s.args[2],where);
+            // every kernel reads element k before writing it, so the
+            // result may take the register of an operand that dies here
+            for(uint32_t j = 0;j<s.count;j++){
+                uint32_t a = s.args[j];
+                bool repeat = std::find(s.args,s.args+j,a)!=s.args+j;
+                if(is_apply(a)&&last[a]==i&&!repeat) spare.push_back(where[a]);
+            }
+            if(s.id==root){
+                in.dst = out_reg;
+            }else if(!spare.empty()){
+                in.dst = spare.back();
+                spare.pop_back();
+            }else{
+                in.dst = nregs++;
+            }
+            where[s.id] = in.dst;
+            code.push_back(in);
+        }
+        result = ref(g,root,where);
+    }
+};
+
+/*****************************ProgramProxy********************************/
+template<typename T>
+class ProgramProxy{
+public:
+    using value_type = T;
+    using result_type = T;
+
+    ProgramProxy(const expr_program<T>& p,std::shared_ptr<const runtime_detail::binding<T>> b):program(&p),inputs(std::move(b)){}
+
+    uint64_t size() const{ return inputs->n; }
+
+    // one element at a time through the interpreter; assign the node to a
+    // valarray to get the block kernels
+    value_type operator[](uint64_t k) const{
+        return program->at(inputs->in.data(),k);
+    }
+
+    template<typename U>
+    void evaluate_into(U* out,uint64_t n) const{
+        into(out,n,std::is_same<U,T>{});
+    }
+
+    using const_iterator = MyIterator<ProgramProxy>;
+    const_iterator begin() const{ return const_iterator{*this,0}; }
+    const_iterator end() const{ return const_iterator{*this,size()}; }
+
+private:
+    const expr_program<T>* program;
+    std::shared_ptr<const runtime_detail::binding<T>> inputs;
+
+    void into(T* out,uint64_t n,std::true_type) const{
+        program->run(out,inputs->in.data(),n);
+    }
+    template<typename U>
+    void into(U* out,uint64_t n,std::false_type) const{
+        std::vector<T> r(n);
+        program->run(r.data(),inputs->in.data(),n);
+        for(uint64_t k = 0;k<n;k++){
+            out[k] = static_cast<U>(r[k]);
+        }
+    }
+};
+
+#endif /* _runtime_expr_h */
@@ -0,0 +1,290 @@
+// Scan.h -- inclusive, exclusive and segmented scans over valarray expressions
+//
+// #include "Vector.h" and "Valarray.h" before this file.
+//
+// A scan is a running accumulate: r[k] = x[0] op x[1] op ... op x[k]. op
+// has to be associative, since the input is scanned as independent chunks
+// on the epl::thread_pool first, and the total of every chunk before a
+// chunk is then folded into it in a second pass. Each element of a lazy
+// expression is evaluated only once, in the first pass. Sums of float and
+// int32_t are scanned four to a register with SSE2 shifts, so float sums
+// are added in a different order than a sequential loop would use; with
+// two lanes of double or int64_t the shuffles cost what they save.
+
+#ifndef _scan_h
+#define _scan_h
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "ParallelAlgorithms.h"
+
+namespace scan_detail{
+    template<typename Acc,typename T>
+    using result = typename std::conditional<std::is_void<Acc>::value,typename T::value_type,Acc>::type;
+
+    /*****************************evaluation********************************/
+    // x[b, e) into out[b, e), through the pointer for plain vectors
+    template<typename R,typename V>
+    void load(R* out,const Wrap<V>& x,uint64_t b,uint64_t e,std::true_type /*plain vector*/){
+        const typename V::value_type* p = &x[0];
+        for(uint64_t k = b;k<e;k++){
+            out[k] = static_cast<R>(p[k]);
+        }
+    }
+    template<typename R,typename V>
+    void load(R* out,const Wrap<V>& x,uint64_t b,uint64_t e,std::false_type){
+        for(uint64_t k = b;k<e;k++){
+            out[k] = static_cast<R>(x[k]);
+        }
+    }
+    template<typename R,typename V>
+    void load(R* out,const Wrap<V>& x,uint64_t b,uint64_t e){
+        load(out,x,b,e,typename dot_detail::is_plain<V>::type{});
+    }
+
+    // flags[b, e) as 0/1
+    template<typename V>
+    void load_flags(unsigned char* out,const Wrap<V>& flags,uint64_t b,uint64_t e,std::true_type /*plain vector*/){
+        const typename V::value_type* p = &flags[0];
+        for(uint64_t k = b;k<e;k++){
+            out[k] = p[k]!=0;
+        }
+    }
+    template<typename V>
+    void load_flags(unsigned char* out,const Wrap<V>& flags,uint64_t b,uint64_t e,std::false_type){
+        for(uint64_t k = b;k<e;k++){
+            out[k] = flags[k]!=0;
+        }
+    }
+
+    /*****************************in-register scans********************************/
+    // out[k] = carry op in[0] op ... op in[k]; in may be out
+    template<typename T,typename S,typename Op>
+    void scan_run(T* out,const S* in,uint64_t n,T carry,bool has_carry,Op op,std::false_type /*scalar*/){
+        if(n==0) return;
+        // the running value stays in a register rather than being read
+        // back from out[k-1]
+        T acc = has_carry ? op(carry,static_cast<T>(in[0])) : static_cast<T>(in[0]);
+        out[0] = acc;
+        for(uint64_t k = 1;k<n;k++){
+            acc = op(acc,static_cast<T>(in[k]));
+            out[k] = acc;
+        }
+    }
+
+    template<typename T,typename Op> struct packed:std::false_type{};
+#ifdef __SSE2__
+    // one register of prefix sums: shift the register up a lane and add,
+    // doubling the shift each time
+    template<typename T> struct sums;
+    template<> struct sums<float>{
+        using reg = __m128;
+        static constexpr uint64_t width = 4;
+        static reg load(const float* p){ return _mm_loadu_ps(p); }
+        static void store(float* p,reg v){ _mm_storeu_ps(p,v); }
+        static reg set1(float a){ return _mm_set1_ps(a); }
+        static reg add(reg a,reg b){ return _mm_add_ps(a,b); }
+        static reg scan(reg x){
+            x = _mm_add_ps(x,_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x),4)));
+            return _mm_add_ps(x,_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x),8)));
+        }
+        static reg last(reg x){ return _mm_shuffle_ps(x,x,_MM_SHUFFLE(3,3,3,3)); }
+    };
+    template<> struct sums<int32_t>{
+        using reg = __m128i;
+        static constexpr uint64_t width = 4;
+        static reg load(const int32_t* p){ return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+        static void store(int32_t* p,reg v){ _mm_storeu_si128(reinterpret_cast<__m128i*>(p),v); }
+        static reg set1(int32_t a){ return _mm_set1_epi32(a); }
+        static reg add(reg a,reg b){ return _mm_add_epi32(a,b); }
+        static reg scan(reg x){
+            x = _mm_add_epi32(x,_mm_slli_si128(x,4));
+            return _mm_add_epi32(x,_mm_slli_si128(x,8));
+        }
+        static reg last(reg x){ return _mm_shuffle_epi32(x,_MM_SHUFFLE(3,3,3,3)); }
+    };
+    template<> struct packed<float,std::plus<float>>:std::true_type{};
+    template<> struct packed<int32_t,std::plus<int32_t>>:std::true_type{};
+
+    template<typename T,typename Op>
+    void scan_run(T* out,const T* in,uint64_t n,T carry,bool has_carry,Op op,std::true_type){
+        using P = sums<T>;
+        constexpr uint64_t W = P::width;
+        typename P::reg c = P::set1(has_carry ? carry : T(0));
+        uint64_t k = 0;
+        for(;k+W<=n;k += W){
+            typename P::reg x = P::add(P::scan(P::load(in+k)),c);
+            P::store(out+k,x);
+            c = P::last(x);
+        }
+        if(k==n) return;
+        scan_run(out+k,in+k,n-k,k==0 ? carry : out[k-1],k!=0||has_carry,op,std::false_type{});
+    }
+#endif
+
+    template<typename T,typename S,typename Op>
+    void scan_run(T* out,const S* in,uint64_t n,T carry,bool has_carry,Op op){
+        scan_run(out,in,n,carry,has_carry,op,
+                 std::integral_constant<bool,packed<T,Op>::value&&std::is_same<T,S>::value>{});
+    }
+
+    // x[b, e) scanned into out[b, e): a plain vector straight from its
+    // storage, an expression evaluated into out a block at a time and
+    // scanned in place while the block is still in L1
+    static constexpr uint64_t block = 2048;
+    template<typename R,typename V,typename Op>
+    void scan_range(R* out,const Wrap<V>& x,uint64_t b,uint64_t e,R carry,bool has_carry,Op op,std::true_type /*plain vector*/){
+        const typename V::value_type* p = &x[0];
+        scan_run(out+b,p+b,e-b,carry,has_carry,op);
+    }
+    template<typename R,typename V,typename Op>
+    void scan_range(R* out,const Wrap<V>& x,uint64_t b,uint64_t e,R carry,bool has_carry,Op op,std::false_type){
+        for(uint64_t k = b;k<e;k += block){
+            uint64_t f = std::min(k+block,e);
+            load(out,x,k,f);
+            scan_run(out+k,out+k,f-k,k==b ? carry : out[k-1],k!=b||has_carry,op);
+        }
+    }
+    template<typename R,typename V,typename Op>
+    void scan_range(R* out,const Wrap<V>& x,uint64_t b,uint64_t e,R carry,bool has_carry,Op op){
+        scan_range(out,x,b,e,carry,has_carry,op,typename dot_detail::is_plain<V>::type{});
+    }
+
+    // the second pass is pure overhead unless another thread shares the first
+    inline uint64_t chunks(uint64_t n,epl::thread_pool& pool){
+        return pool.threads()==1 ? 1 : epl::parallel_detail::chunk_count(n,pool);
+    }
+
+    /*****************************two passes********************************/
+    // out[k] = init op x[0] op ... op x[k] (without init unless has_init);
+    // chunk c scans on its own into out, then gets the total of chunks
+    // before it folded in from the left
+    template<typename R,typename V,typename Op>
+    void inclusive(R* out,const Wrap<V>& x,uint64_t n,R init,bool has_init,Op op,epl::thread_pool& pool){
+        if(n==0) return;
+        uint64_t count = scan_detail::chunks(n,pool);
+        if(count==1){
+            scan_range(out,x,0,n,init,has_init,op);
+            return;
+        }
+        pool.run(count,[&](uint64_t c){
+            uint64_t b = epl::parallel_detail::chunk_begin(c,count,n);
+            uint64_t e = epl::parallel_detail::chunk_begin(c+1,count,n);
+            scan_range(out,x,b,e,init,has_init&&c==0,op);
+        });
+        // carry[c] is everything before chunk c
+        std::vector<R> carry(count);
+        for(uint64_t c = 1;c<count;c++){
+            R last = out[epl::parallel_detail::chunk_begin(c,count,n)-1];
+            carry[c] = c==1 ? last : op(carry[c-1],last);
+        }
+        pool.run(count-1,[&](uint64_t c){
+            uint64_t b = epl::parallel_detail::chunk_begin(c+1,count,n);
+            uint64_t e = epl::parallel_detail::chunk_begin(c+2,count,n);
+            R before = carry[c+1];
+            for(uint64_t k = b;k<e;k++){
+                out[k] = op(before,out[k]);
+            }
+        });
+    }
+
+    /*****************************segments********************************/
+    // a[k] = a[seg] op ... op a[k], seg the last k' <= k with flag set (or
+    // the start); returns whether any flag in [0, n) was set
+    template<typename T,typename F,typename Op>
+    bool segment_run(T* a,const F* flag,uint64_t n,Op op){
+        bool any = n!=0&&flag[0];
+        for(uint64_t k = 1;k<n;k++){
+            if(flag[k]){
+                any = true;
+            }else{
+                a[k] = op(a[k-1],a[k]);
+            }
+        }
+        return any;
+    }
+}
+
+/*****************************inclusive scan********************************/
+// r[k] = x[0] op ... op x[k]; inclusive_scan<double>(counts) accumulates
+// integer counts as double
+template<typename Acc = void,typename T,typename Op = std::plus<scan_detail::result<Acc,T>>>
+valarray<scan_detail::result<Acc,T>> inclusive_scan(const Wrap<T>& x,Op op = Op{},
+                                                    epl::thread_pool& pool = epl::default_pool()){
+    using R = scan_detail::result<Acc,T>;
+    valarray<R> r(x.size());
+    if(x.size()==0) return r;
+    scan_detail::inclusive(&r[0],x,x.size(),R(),false,op,pool);
+    return r;
+}
+
+/*****************************exclusive scan********************************/
+// r[0] = init, r[k] = init op x[0] op ... op x[k-1]
+template<typename Acc = void,typename T,typename Op = std::plus<scan_detail::result<Acc,T>>>
+valarray<scan_detail::result<Acc,T>> exclusive_scan(const Wrap<T>& x,scan_detail::result<Acc,T> init,Op op = Op{},
+                                                    epl::thread_pool& pool = epl::default_pool()){
+    using R = scan_detail::result<Acc,T>;
+    valarray<R> r(x.size());
+    if(x.size()==0) return r;
+    r[0] = init;
+    // x[0, n-1) scanned one place to the right
+    scan_detail::inclusive(&r[0]+1,x,x.size()-1,init,true,op,pool);
+    return r;
+}
+
+/*****************************segmented scan********************************/
+// an inclusive scan that restarts wherever flags[k] is nonzero, so each
+// run of x between two flags is scanned on its own; flags is any 1-D
+// expression as long as x
+template<typename Acc = void,typename T,typename F,typename Op = std::plus<scan_detail::result<Acc,T>>>
+valarray<scan_detail::result<Acc,T>> segmented_scan(const Wrap<T>& x,const Wrap<F>& flags,Op op = Op{},
+                                                    epl::thread_pool& pool = epl::default_pool()){
+    using R = scan_detail::result<Acc,T>;
+    uint64_t n = x.size();
+    if(flags.size()!=n){
+        throw std::invalid_argument("segmented_scan flags and values differ in length");
+    }
+    valarray<R> r(n);
+    if(n==0) return r;
+    R* out = &r[0];
+    std::vector<unsigned char> flag(n);
+    uint64_t count = scan_detail::chunks(n,pool);
+    // chunk c: a scan of its own segments, whether a flag cut it, and its
+    // last value
+    std::vector<unsigned char> cut(count);
+    auto local = [&](uint64_t c){
+        uint64_t b = epl::parallel_detail::chunk_begin(c,count,n);
+        uint64_t e = epl::parallel_detail::chunk_begin(c+1,count,n);
+        scan_detail::load(out,x,b,e);
+        scan_detail::load_flags(flag.data(),flags,b,e,typename dot_detail::is_plain<F>::type{});
+        cut[c] = scan_detail::segment_run(out+b,flag.data()+b,e-b,op);
+    };
+    if(count==1){
+        local(0);
+        return r;
+    }
+    pool.run(count,local);
+    // (cut, value) pairs combine associatively: a cut on the right
+    // discards whatever came from the left
+    std::vector<R> carry(count);
+    for(uint64_t c = 1;c<count;c++){
+        R last = out[epl::parallel_detail::chunk_begin(c,count,n)-1];
+        carry[c] = (c==1||cut[c-1]) ? last : op(carry[c-1],last);
+    }
+    pool.run(count-1,[&](uint64_t c){
+        c++;
+        uint64_t b = epl::parallel_detail::chunk_begin(c,count,n);
+        uint64_t e = epl::parallel_detail::chunk_begin(c+1,count,n);
+        R before = carry[c];
+        for(uint64_t k = b;k<e&&!flag[k];k++){
+            out[k] = op(before,out[k]);
+        }
+    });
+    return r;
+}
+
+#endif /* _scan_h */
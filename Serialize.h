@@ -0,0 +1,415 @@
+// Serialize.h -- compact binary format for epl::vector, valarray and lazy expressions
+//
+// #include "Vector.h" before this file, the same way as for Valarray.h.
+//
+// Layout: a 32 byte binary_header followed by length elements in the
+// writer's native byte order. For trivially copyable T an epl::vector is
+// written and read with one stream call, and view_binary() reads straight
+// out of a buffer (e.g. a mapped file) without copying. Anything else that
+// has size() and operator[] (valarray expressions) is streamed in blocks.
+
+#ifndef _serialize_h
+#define _serialize_h
+
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace epl{
+
+    /*********************type tags**************************/
+    // 0 means "some trivially copyable type", checked by size only
+    template<typename T> struct type_tag{ static constexpr uint8_t value = 0; static constexpr uint32_t component = sizeof(T); };
+    template<> struct type_tag<int8_t>{ static constexpr uint8_t value = 1; static constexpr uint32_t component = 1; };
+    template<> struct type_tag<uint8_t>{ static constexpr uint8_t value = 2; static constexpr uint32_t component = 1; };
+    template<> struct type_tag<int16_t>{ static constexpr uint8_t value = 3; static constexpr uint32_t component = 2; };
+    template<> struct type_tag<uint16_t>{ static constexpr uint8_t value = 4; static constexpr uint32_t component = 2; };
+    template<> struct type_tag<int32_t>{ static constexpr uint8_t value = 5; static constexpr uint32_t component = 4; };
+    template<> struct type_tag<uint32_t>{ static constexpr uint8_t value = 6; static constexpr uint32_t component = 4; };
+    template<> struct type_tag<int64_t>{ static constexpr uint8_t value = 7; static constexpr uint32_t component = 8; };
+    template<> struct type_tag<uint64_t>{ static constexpr uint8_t value = 8; static constexpr uint32_t component = 8; };
+    template<> struct type_tag<float>{ static constexpr uint8_t value = 9; static constexpr uint32_t component = 4; };
+    template<> struct type_tag<double>{ static constexpr uint8_t value = 10; static constexpr uint32_t component = 8; };
+    template<> struct type_tag<std::complex<float>>{ static constexpr uint8_t value = 11; static constexpr uint32_t component = 4; };
+    template<> struct type_tag<std::complex<double>>{ static constexpr uint8_t value = 12; static constexpr uint32_t component = 8; };
+
+    /*********************header**************************/
+    struct binary_header{
+        char magic[4];          // "EPLA"
+        uint8_t format;         // layout version, currently 1
+        uint8_t little_endian;  // byte order of the payload
+        uint8_t tag;            // type_tag<T>::value
+        uint8_t reserved;
+        uint32_t elem_size;
+        uint64_t length;
+        uint64_t checksum;      // binary_checksum of the payload bytes
+    };
+    static_assert(sizeof(binary_header)==32,"binary_header must stay 32 bytes");
+
+    inline bool native_little_endian(void){
+        const uint16_t one = 1;
+        return *reinterpret_cast<const uint8_t*>(&one)==1;
+    }
+
+    /*********************checksum**************************/
+    // FNV-1a over little-endian 8 byte words, fast enough to keep up with
+    // disk; bytes may arrive in pieces of any size and give the same result
+    class binary_checksum {
+    private:
+        uint64_t h;
+        uint64_t pending;       // bytes of a partial word
+        unsigned char word[8];
+
+        static constexpr uint64_t prime = 0x100000001b3ULL;
+
+        void mix(const unsigned char* b){
+            uint64_t w = 0;
+            for(int k = 7;k>=0;k--){
+                w = (w<<8)|b[k];      // compiles to one load on little-endian machines
+            }
+            h ^= w;
+            h *= prime;
+        }
+
+    public:
+        binary_checksum(void):h(0xcbf29ce484222325ULL),pending(0){}
+
+        void update(const void* p,uint64_t n){
+            const unsigned char* b = static_cast<const unsigned char*>(p);
+            while(pending!=0&&n!=0){
+                word[pending++] = *b++;
+                n--;
+                if(pending==8){
+                    mix(word);
+                    pending = 0;
+                }
+            }
+            for(;n>=8;n -= 8,b += 8){
+                mix(b);
+            }
+            for(;n!=0;n--){
+                word[pending++] = *b++;
+            }
+        }
+
+        uint64_t value(void) const{
+            binary_checksum tail{*this};
+            for(uint64_t k = 0;k<tail.pending;k++){
+                tail.h ^= tail.word[k];
+                tail.h *= prime;
+            }
+            tail.h ^= pending;
+            return tail.h;
+        }
+    };
+
+    namespace serialize_detail{
+        inline void swap_components(void* p,uint64_t bytes,uint32_t component){
+            if(component<2) return;
+            unsigned char* b = static_cast<unsigned char*>(p);
+            for(uint64_t k = 0;k+component<=bytes;k += component){
+                for(uint32_t i = 0,j = component-1;i<j;i++,j--){
+                    std::swap(b[k+i],b[k+j]);
+                }
+            }
+        }
+
+        template<typename T>
+        binary_header make_header(uint64_t length,uint64_t checksum){
+            binary_header h;
+            std::memset(&h,0,sizeof(h));    // padding after elem_size too
+            std::memcpy(h.magic,"EPLA",4);
+            h.format = 1;
+            h.little_endian = native_little_endian() ? 1 : 0;
+            h.tag = type_tag<T>::value;
+            h.reserved = 0;
+            h.elem_size = sizeof(T);
+            h.length = length;
+            h.checksum = checksum;
+            return h;
+        }
+
+        // the header as stored is in the writer's byte order
+        template<typename T>
+        binary_header check_header(binary_header h){
+            if(std::memcmp(h.magic,"EPLA",4)!=0||h.format!=1){
+                throw std::runtime_error("not an epl binary array");
+            }
+            if((h.little_endian!=0)!=native_little_endian()){
+                swap_components(&h.elem_size,4,4);
+                swap_components(&h.length,8,8);
+                swap_components(&h.checksum,8,8);
+            }
+            if(h.tag!=type_tag<T>::value||h.elem_size!=sizeof(T)){
+                throw std::runtime_error("binary array holds a different element type");
+            }
+            if(h.tag==0&&(h.little_endian!=0)!=native_little_endian()){
+                throw std::runtime_error("cannot byte swap an untagged element type");
+            }
+            return h;
+        }
+
+        inline void write_bytes(std::ostream& out,const void* p,uint64_t n){
+            out.write(static_cast<const char*>(p),static_cast<std::streamsize>(n));
+            if(!out){
+                throw std::runtime_error("binary write failed");
+            }
+        }
+
+        inline void read_bytes(std::istream& in,void* p,uint64_t n){
+            in.read(static_cast<char*>(p),static_cast<std::streamsize>(n));
+            if(static_cast<uint64_t>(in.gcount())!=n){
+                throw std::runtime_error("binary array is truncated");
+            }
+        }
+    }
+
+    /*********************streaming writer**************************/
+    // writes a placeholder header, then elements in any number of pieces;
+    // finish() seeks back and fills in length and checksum, so the stream
+    // has to be seekable (a file, not a pipe)
+    template<typename T>
+    class binary_writer {
+        static_assert(std::is_trivially_copyable<T>::value,"binary format needs trivially copyable elements");
+
+    private:
+        std::ostream& out;
+        std::streampos head;
+        uint64_t count;
+        binary_checksum sum;
+        bool done;
+
+    public:
+        explicit binary_writer(std::ostream& o):out(o),count(0),done(false){
+            head = out.tellp();
+            if(head==std::streampos(-1)){
+                throw std::runtime_error("binary_writer needs a seekable stream");
+            }
+            binary_header h = serialize_detail::make_header<T>(0,0);
+            serialize_detail::write_bytes(out,&h,sizeof(h));
+        }
+
+        binary_writer(binary_writer const&) = delete;
+        binary_writer& operator=(binary_writer const&) = delete;
+
+        void write(const T* p,uint64_t n){
+            sum.update(p,n*sizeof(T));
+            serialize_detail::write_bytes(out,p,n*sizeof(T));
+            count += n;
+        }
+
+        void write(T const& val){ write(&val,1); }
+
+        void finish(void){
+            if(done) return;
+            std::streampos here = out.tellp();
+            binary_header h = serialize_detail::make_header<T>(count,sum.value());
+            out.seekp(head);
+            serialize_detail::write_bytes(out,&h,sizeof(h));
+            out.seekp(here);
+            done = true;
+        }
+    };
+
+    /*********************streaming reader**************************/
+    template<typename T>
+    class binary_reader {
+        static_assert(std::is_trivially_copyable<T>::value,"binary format needs trivially copyable elements");
+
+    private:
+        std::istream& in;
+        binary_header h;
+        uint64_t remaining;
+        binary_checksum sum;
+        bool swap;
+
+    public:
+        explicit binary_reader(std::istream& i):in(i){
+            binary_header raw;
+            serialize_detail::read_bytes(in,&raw,sizeof(raw));
+            h = serialize_detail::check_header<T>(raw);
+            remaining = h.length;
+            swap = (h.little_endian!=0)!=native_little_endian();
+        }
+
+        uint64_t size(void) const{ return h.length; }
+
+        // returns how many elements were read, 0 at the end
+        uint64_t read(T* p,uint64_t n){
+            if(n>remaining) n = remaining;
+            serialize_detail::read_bytes(in,p,n*sizeof(T));
+            sum.update(p,n*sizeof(T));
+            if(swap) serialize_detail::swap_components(p,n*sizeof(T),type_tag<T>::component);
+            remaining -= n;
+            if(remaining==0&&sum.value()!=h.checksum){
+                throw std::runtime_error("binary array checksum mismatch");
+            }
+            return n;
+        }
+    };
+
+    /*********************whole arrays**************************/
+    namespace serialize_detail{
+        // epl::vector (and valarray, which derives from it): length and
+        // checksum are known up front, header and payload go out in order
+        template<typename T>
+        void write_array(std::ostream& out,vector<T> const& v,std::true_type){
+            uint64_t n = v.size();
+            binary_checksum sum;
+            if(n) sum.update(&v[0],n*sizeof(T));
+            binary_header h = make_header<T>(n,sum.value());
+            write_bytes(out,&h,sizeof(h));
+            if(n) write_bytes(out,&v[0],n*sizeof(T));
+        }
+
+        // lazy expressions: evaluated a block at a time. A seekable stream
+        // gets one pass and a patched header; anything else (a pipe) is
+        // evaluated twice, once for the checksum and once for the payload
+        template<typename V,typename T,typename Write>
+        void each_block(V const& v,T* buf,uint64_t block,Write write){
+            uint64_t n = v.size();
+            for(uint64_t k = 0;k<n;k += block){
+                uint64_t m = (n-k<block) ? n-k : block;
+                for(uint64_t i = 0;i<m;i++){
+                    buf[i] = v[k+i];
+                }
+                write(buf,m);
+            }
+        }
+
+        template<typename V>
+        void write_array(std::ostream& out,V const& v,std::false_type){
+            using T = typename std::decay<decltype(v[0])>::type;
+            static constexpr uint64_t block = 4096;
+            std::unique_ptr<T[]> buf{new T[block]};
+            if(out.tellp()!=std::streampos(-1)){
+                binary_writer<T> w{out};
+                each_block(v,buf.get(),block,[&w](const T* p,uint64_t m){ w.write(p,m); });
+                w.finish();
+                return;
+            }
+            binary_checksum sum;
+            each_block(v,buf.get(),block,[&sum](const T* p,uint64_t m){ sum.update(p,m*sizeof(T)); });
+            binary_header h = make_header<T>(v.size(),sum.value());
+            write_bytes(out,&h,sizeof(h));
+            each_block(v,buf.get(),block,[&out](const T* p,uint64_t m){ write_bytes(out,p,m*sizeof(T)); });
+        }
+    }
+
+    template<typename V>
+    void write_binary(std::ostream& out,V const& v){
+        using T = typename std::decay<decltype(v[0])>::type;
+        static_assert(std::is_trivially_copyable<T>::value,"binary format needs trivially copyable elements");
+        serialize_detail::write_array(out,v,typename std::is_base_of<vector<T>,V>::type{});
+    }
+
+    namespace serialize_detail{
+        // bytes left after the read position, false if the stream cannot seek
+        inline bool bytes_left(std::istream& in,uint64_t& n){
+            std::istream::pos_type here = in.tellg();
+            if(here==std::istream::pos_type(-1)) return false;
+            in.seekg(0,std::ios_base::end);
+            std::istream::pos_type end = in.tellg();
+            in.clear(in.rdstate()&~std::ios_base::failbit);
+            in.seekg(here);
+            if(end==std::istream::pos_type(-1)||end<here) return false;
+            n = static_cast<uint64_t>(end-here);
+            return true;
+        }
+
+        // elements the first buffer of an unseekable stream holds
+        static constexpr uint64_t first_block = 1<<16;
+    }
+
+    // v is replaced. The length in the header is not trusted for the
+    // allocation: a seekable stream has to hold the whole payload first
+    // and is then read in bulk, anything else (a pipe) is read into a
+    // buffer that doubles as data actually arrives
+    template<typename T>
+    void read_binary(std::istream& in,vector<T>& v){
+        binary_reader<T> r{in};
+        uint64_t n = r.size();
+        uint64_t left = 0;
+        bool seekable = serialize_detail::bytes_left(in,left);
+        if(seekable&&left/sizeof(T)<n){
+            throw std::runtime_error("binary array is truncated");
+        }
+        vector<T> tmp(seekable ? n : std::min(n,serialize_detail::first_block));
+        uint64_t got = 0;
+        while(got<n){
+            if(got==tmp.size()){
+                vector<T> bigger(std::min(n,2*got));
+                std::memcpy(static_cast<void*>(&bigger[0]),&tmp[0],got*sizeof(T));
+                tmp = std::move(bigger);
+            }
+            got += r.read(&tmp[got],tmp.size()-got);
+        }
+        v = std::move(tmp);
+    }
+
+    /*********************zero-copy view**************************/
+    template<typename T>
+    class array_view {
+    private:
+        const T* ptr;
+        uint64_t len;
+
+    public:
+        using value_type = T;
+
+        array_view(const T* p,uint64_t n):ptr(p),len(n){}
+
+        uint64_t size(void) const{ return len; }
+
+        const T& operator[](uint64_t k) const{
+            if(k>=len){
+                throw std::out_of_range("subscript ouf of range");
+            }
+            return ptr[k];
+        }
+
+        const T* begin(void) const{ return ptr; }
+        const T* end(void) const{ return ptr+len; }
+    };
+
+    // buf must hold a whole serialized array in native byte order and stay
+    // alive as long as the view
+    template<typename T>
+    array_view<T> view_binary(const void* buf,uint64_t bytes,bool verify = true){
+        static_assert(std::is_trivially_copyable<T>::value,"binary format needs trivially copyable elements");
+        if(bytes<sizeof(binary_header)){
+            throw std::runtime_error("binary array is truncated");
+        }
+        binary_header raw;
+        std::memcpy(&raw,buf,sizeof(raw));
+        binary_header h = serialize_detail::check_header<T>(raw);
+        if((h.little_endian!=0)!=native_little_endian()){
+            throw std::runtime_error("cannot view a foreign byte order array, use read_binary");
+        }
+        if((bytes-sizeof(binary_header))/sizeof(T)<h.length){
+            throw std::runtime_error("binary array is truncated");
+        }
+        const unsigned char* payload = static_cast<const unsigned char*>(buf)+sizeof(binary_header);
+        if(reinterpret_cast<uintptr_t>(payload)%alignof(T)!=0){
+            throw std::runtime_error("binary array buffer is misaligned");
+        }
+        if(verify){
+            binary_checksum sum;
+            sum.update(payload,h.length*sizeof(T));
+            if(sum.value()!=h.checksum){
+                throw std::runtime_error("binary array checksum mismatch");
+            }
+        }
+        return array_view<T>{reinterpret_cast<const T*>(payload),h.length};
+    }
+
+} //namespace epl
+
+#endif /* _serialize_h */
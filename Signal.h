@@ -0,0 +1,294 @@
+// Signal.h -- convolution, FIR filtering and moving-window reductions over valarray expressions
+//
+// #include "Vector.h" and "Valarray.h" before this file; the lazy shift()
+// and stencil() nodes live in Valarray.h itself.
+//
+// convolve() and fir() pick their method from the kernel length. Short
+// kernels run directly: every tap is a packed multiply-add of the input
+// into a block of the output that stays in cache. Long kernels go through
+// overlap-add with a radix-2 FFT, two real input blocks packed into one
+// complex transform. Integer data always takes the direct path, so it
+// stays exact.
+//
+// The rolling reductions use the van Herk/Gil-Werman scheme: cut the input
+// into blocks of the window length and take a prefix and a suffix scan of
+// every block. A window then covers the tail of one block and the head of
+// the next, so it is one combine of two scans whatever the window length,
+// and sums are never updated by subtraction, so no rounding drift builds up.
+
+#ifndef _signal_h
+#define _signal_h
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace signal_detail{
+    // up to this many taps the direct form beats the transforms
+    static constexpr uint64_t direct_taps = 48;
+    // outputs per block of the direct form, sized to stay in L1
+    static constexpr uint64_t direct_block = 2048;
+
+    template<typename T>
+    using pack = simd_detail::simd_pack<T>;
+
+    // any 1-D expression into contiguous storage, evaluated once
+    template<typename R,typename V>
+    std::vector<R> evaluate(const Wrap<V>& x){
+        std::vector<R> r(x.size());
+        for(uint64_t k = 0;k<r.size();k++){
+            r[k] = static_cast<R>(x[k]);
+        }
+        return r;
+    }
+
+    /*****************************direct form********************************/
+    // out[k] += a*x[k] for k < n
+    template<typename T>
+    void axpy(T* out,const T* x,uint64_t n,T a){
+        using P = pack<T>;
+        constexpr uint64_t W = P::width;
+        typename P::reg va = P::set1(a);
+        uint64_t k = 0;
+        for(;k+W<=n;k += W){
+            P::store(out+k,P::add(P::load(out+k),P::mul(va,P::load(x+k))));
+        }
+        for(;k<n;k++){
+            out[k] += a*x[k];
+        }
+    }
+
+    // the first len outputs of the full convolution of x (n) with h (m)
+    template<typename T>
+    void direct(T* out,uint64_t len,const T* x,uint64_t n,const T* h,uint64_t m){
+        std::fill(out,out+len,T(0));
+        for(uint64_t o0 = 0;o0<len;o0 += direct_block){
+            uint64_t o1 = std::min(o0+direct_block,len);
+            for(uint64_t j = 0;j<m;j++){
+                // out[i+j] += h[j]*x[i] for the i that land in [o0, o1)
+                uint64_t b = o0>j ? o0-j : 0;
+                uint64_t e = std::min(o1-j,n);
+                if(o1<=j||b>=e) continue;
+                axpy(out+b+j,x+b,e-b,h[j]);
+            }
+        }
+    }
+
+    /*****************************fft********************************/
+    // in-place radix-2 transform of n = 2^p points, forward is exp(-2 pi i jk/n);
+    // tw holds the n/2 forward twiddles, the inverse conjugates them and
+    // leaves the 1/n to the caller
+    template<typename T>
+    void fft(std::complex<T>* a,uint64_t n,const std::complex<T>* tw,bool inverse){
+        for(uint64_t i = 1,j = 0;i<n;i++){
+            uint64_t bit = n>>1;
+            for(;j&bit;bit >>= 1){
+                j ^= bit;
+            }
+            j ^= bit;
+            if(i<j) std::swap(a[i],a[j]);
+        }
+        T sign = inverse ? T(-1) : T(1);
+        for(uint64_t len = 2;len<=n;len <<= 1){
+            uint64_t half = len/2,step = n/len;
+            for(uint64_t s = 0;s<n;s += len){
+                for(uint64_t k = 0;k<half;k++){
+                    T wr = tw[k*step].real(),wi = sign*tw[k*step].imag();
+                    std::complex<T>& u = a[s+k];
+                    std::complex<T>& v = a[s+k+half];
+                    // plain formulas, std::complex's operator* checks for NaN
+                    T tr = v.real()*wr-v.imag()*wi;
+                    T ti = v.real()*wi+v.imag()*wr;
+                    v = std::complex<T>(u.real()-tr,u.imag()-ti);
+                    u = std::complex<T>(u.real()+tr,u.imag()+ti);
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    std::vector<std::complex<T>> twiddles(uint64_t n){
+        std::vector<std::complex<T>> tw(n/2);
+        const double two_pi = 6.283185307179586476925286766559;
+        for(uint64_t k = 0;k<tw.size();k++){
+            double t = -two_pi*static_cast<double>(k)/static_cast<double>(n);
+            tw[k] = std::complex<T>(static_cast<T>(std::cos(t)),static_cast<T>(std::sin(t)));
+        }
+        return tw;
+    }
+
+    inline uint64_t ceil_pow2(uint64_t n){
+        uint64_t p = 1;
+        while(p<n) p <<= 1;
+        return p;
+    }
+
+    // overlap-add: blocks of L = N-m+1 inputs, each convolved with h through
+    // an N point transform. h is real, so its spectrum is hermitian and the
+    // product with the spectrum of xa + i*xb transforms back to ya + i*yb:
+    // one forward and one inverse transform cover two blocks
+    template<typename T>
+    void overlap_add(T* out,uint64_t len,const T* x,uint64_t n,const T* h,uint64_t m){
+        std::fill(out,out+len,T(0));
+        uint64_t N = std::min(ceil_pow2(n+m-1),std::max<uint64_t>(ceil_pow2(4*m),1024));
+        uint64_t L = N-m+1;
+        std::vector<std::complex<T>> tw = twiddles<T>(N);
+        std::vector<std::complex<T>> H(N),Z(N);
+        for(uint64_t j = 0;j<m;j++){
+            H[j] = std::complex<T>(h[j],T(0));
+        }
+        fft(H.data(),N,tw.data(),false);
+        T scale = T(1)/static_cast<T>(N);
+        for(uint64_t s = 0;s<n&&s<len;s += 2*L){
+            uint64_t na = std::min(L,n-s);
+            uint64_t nb = s+L<n ? std::min(L,n-s-L) : 0;
+            for(uint64_t k = 0;k<N;k++){
+                T re = k<na ? x[s+k] : T(0);
+                T im = k<nb ? x[s+L+k] : T(0);
+                Z[k] = std::complex<T>(re,im);
+            }
+            fft(Z.data(),N,tw.data(),false);
+            for(uint64_t k = 0;k<N;k++){
+                T zr = Z[k].real(),zi = Z[k].imag(),hr = H[k].real(),hi = H[k].imag();
+                Z[k] = std::complex<T>((zr*hr-zi*hi)*scale,(zr*hi+zi*hr)*scale);
+            }
+            fft(Z.data(),N,tw.data(),true);
+            uint64_t ea = std::min(na+m-1,len-s);
+            for(uint64_t k = 0;k<ea;k++){
+                out[s+k] += Z[k].real();
+            }
+            if(nb!=0&&s+L<len){
+                uint64_t eb = std::min(nb+m-1,len-s-L);
+                for(uint64_t k = 0;k<eb;k++){
+                    out[s+L+k] += Z[k].imag();
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    void convolve(T* out,uint64_t len,const T* x,uint64_t n,const T* h,uint64_t m,std::true_type /*floating*/){
+        if(m<=direct_taps||n<=direct_taps){
+            direct(out,len,x,n,h,m);
+        }else{
+            overlap_add(out,len,x,n,h,m);
+        }
+    }
+    template<typename T>
+    void convolve(T* out,uint64_t len,const T* x,uint64_t n,const T* h,uint64_t m,std::false_type){
+        direct(out,len,x,n,h,m);
+    }
+
+    template<typename V1,typename V2>
+    using result = ChooseType<typename V1::value_type,typename V2::value_type>;
+
+    template<typename R,typename V1,typename V2>
+    valarray<R> filter(const Wrap<V1>& x,const Wrap<V2>& h,uint64_t len){
+        std::vector<R> xs = evaluate<R>(x),hs = evaluate<R>(h);
+        valarray<R> r(len);
+        if(len==0) return r;
+        convolve(&r[0],len,xs.data(),xs.size(),hs.data(),hs.size(),std::is_floating_point<R>{});
+        return r;
+    }
+
+    /*****************************moving windows********************************/
+    // r[i] = x[i] op ... op x[i+w-1] for every window that fits
+    template<typename R,typename V,typename Op>
+    valarray<R> rolling(const Wrap<V>& x,uint64_t w,Op op){
+        if(w==0){
+            throw std::invalid_argument("rolling window of length 0");
+        }
+        uint64_t n = x.size();
+        uint64_t count = n>=w ? n-w+1 : 0;
+        valarray<R> r(count);
+        if(count==0) return r;
+        // xs is turned into suffix scans one block ahead of the windows:
+        // windows starting in block b read the scanned block b and the raw
+        // head of block b+1, folded into a running prefix
+        std::vector<R> xs = evaluate<R>(x);
+        auto suffix = [&xs,op](uint64_t b,uint64_t e){
+            for(uint64_t k = e-1;k>b;k--){
+                xs[k-1] = op(xs[k-1],xs[k]);
+            }
+        };
+        R* out = &r[0];
+        suffix(0,std::min(w,n));
+        for(uint64_t b = 0;b<count;b += w){
+            uint64_t e = std::min(b+w,count);
+            out[b] = xs[b];
+            if(e>b+1){
+                R head = xs[b+w];
+                out[b+1] = op(xs[b+1],head);
+                for(uint64_t i = b+2;i<e;i++){
+                    head = op(head,xs[i+w-1]);
+                    out[i] = op(xs[i],head);
+                }
+            }
+            if(b+w<n) suffix(b+w,std::min(b+2*w,n));
+        }
+        return r;
+    }
+
+    template<typename T>
+    struct min_of{
+        T operator()(const T& a,const T& b) const{ return b<a ? b : a; }
+    };
+    template<typename T>
+    struct max_of{
+        T operator()(const T& a,const T& b) const{ return a<b ? b : a; }
+    };
+}
+
+/*****************************convolution********************************/
+// the full convolution, x.size()+h.size()-1 elements
+template<typename T1,typename T2>
+valarray<signal_detail::result<T1,T2>> convolve(const Wrap<T1>& x,const Wrap<T2>& h){
+    uint64_t len = x.size()==0||h.size()==0 ? 0 : x.size()+h.size()-1;
+    return signal_detail::filter<signal_detail::result<T1,T2>>(x,h,len);
+}
+
+// causal FIR filter from a zero state: y[i] = h[0]*x[i] + ... + h[m-1]*x[i-m+1],
+// as long as x
+template<typename T1,typename T2>
+valarray<signal_detail::result<T1,T2>> fir(const Wrap<T1>& x,const Wrap<T2>& h){
+    return signal_detail::filter<signal_detail::result<T1,T2>>(x,h,h.size()==0 ? 0 : x.size());
+}
+
+/*****************************moving windows********************************/
+// one result per window of w consecutive elements, x.size()-w+1 of them;
+// O(n) for any w
+template<typename T>
+valarray<typename T::value_type> rolling_sum(const Wrap<T>& x,uint64_t w){
+    using R = typename T::value_type;
+    return signal_detail::rolling<R>(x,w,std::plus<R>{});
+}
+
+template<typename T>
+valarray<ChooseType<typename T::value_type,double>> rolling_mean(const Wrap<T>& x,uint64_t w){
+    using R = ChooseType<typename T::value_type,double>;
+    valarray<R> r = signal_detail::rolling<R>(x,w,std::plus<R>{});
+    R inv = R(1)/static_cast<R>(w);
+    for(uint64_t i = 0;i<r.size();i++){
+        r[i] *= inv;
+    }
+    return r;
+}
+
+template<typename T>
+valarray<typename T::value_type> rolling_min(const Wrap<T>& x,uint64_t w){
+    using R = typename T::value_type;
+    return signal_detail::rolling<R>(x,w,signal_detail::min_of<R>{});
+}
+
+template<typename T>
+valarray<typename T::value_type> rolling_max(const Wrap<T>& x,uint64_t w){
+    using R = typename T::value_type;
+    return signal_detail::rolling<R>(x,w,signal_detail::max_of<R>{});
+}
+
+#endif /* _signal_h */
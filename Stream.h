@@ -0,0 +1,321 @@
+// Stream.h -- chunk-by-chunk evaluation of valarray expressions over data that is not resident
+//
+// #include "Vector.h" and "Valarray.h" before this file.
+//
+// A stream_valarray<T> is an expression leaf over a source: anything with
+// uint64_t read(T* out,uint64_t n) that returns how many elements it
+// produced and 0 at the end. Examples are a file or pipe (raw_source), a
+// generator (make_generator), or the epl::binary_reader of Serialize.h.
+// The usual operators build lazy trees over these leaves.
+//
+// stream_to(sink,expr) then refills every leaf with the next chunk, runs
+// the tree over it and hands the result to sink.write(const R*,n). An
+// epl::binary_writer will do for a file; it seeks back to patch its
+// header, so a pipe needs a raw_sink. It stops at the end of the
+// shortest leaf. Memory is one chunk per distinct leaf plus one for the
+// output, whatever the length of the data. Copies of a leaf share its
+// source and buffer, so x*x reads x once.
+//
+// Only element-wise trees can be streamed: stream leaves, scalars,
+// arithmetic and comparison nodes, apply() and where(). A resident vector,
+// or a node that looks at neighbouring elements (shift, stencil), does
+// not compile under stream_to. Outside stream_to a leaf holds the last
+// chunk it read.
+
+#ifndef _stream_h
+#define _stream_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace stream_detail{
+    // elements per chunk unless stream_to is told otherwise
+    static constexpr uint64_t default_chunk = 1<<16;
+
+    // every refill gets a new tick, a leaf seen twice in a tree reads once
+    inline uint64_t next_tick(void){
+        static std::atomic<uint64_t> tick{0};
+        return ++tick;
+    }
+
+    template<typename S,typename T,typename = void>
+    struct is_source:std::false_type{};
+    template<typename S,typename T>
+    struct is_source<S,T,decltype(static_cast<uint64_t>(std::declval<S&>().read(std::declval<T*>(),uint64_t())),void())>:std::true_type{};
+}
+
+/*****************************sources********************************/
+// native-order elements straight from a file or pipe, no header
+template<typename T>
+class raw_source{
+    static_assert(std::is_trivially_copyable<T>::value,"raw_source needs trivially copyable elements");
+    std::istream& in;
+public:
+    explicit raw_source(std::istream& i):in(i){}
+
+    uint64_t read(T* p,uint64_t n){
+        in.read(reinterpret_cast<char*>(p),static_cast<std::streamsize>(n*sizeof(T)));
+        uint64_t got = static_cast<uint64_t>(in.gcount());
+        if(got%sizeof(T)!=0){
+            throw std::runtime_error("stream ends inside an element");
+        }
+        return got/sizeof(T);
+    }
+};
+
+// count elements of gen(), one call per element
+template<typename T,typename F>
+class generator_source{
+    F gen;
+    uint64_t remaining;
+public:
+    generator_source(F f,uint64_t count):gen(std::move(f)),remaining(count){}
+
+    uint64_t read(T* p,uint64_t n){
+        n = std::min(n,remaining);
+        for(uint64_t k = 0;k<n;k++){
+            p[k] = static_cast<T>(gen());
+        }
+        remaining -= n;
+        return n;
+    }
+};
+
+// without a count the generator never ends; some other leaf has to
+template<typename T,typename F>
+generator_source<T,F> make_generator(F f,uint64_t count = std::numeric_limits<uint64_t>::max()){
+    return generator_source<T,F>{std::move(f),count};
+}
+
+/*****************************sinks********************************/
+template<typename T>
+class raw_sink{
+    std::ostream& out;
+public:
+    explicit raw_sink(std::ostream& o):out(o){}
+
+    void write(const T* p,uint64_t n){
+        out.write(reinterpret_cast<const char*>(p),static_cast<std::streamsize>(n*sizeof(T)));
+        if(!out){
+            throw std::runtime_error("stream write failed");
+        }
+    }
+};
+
+/*****************************stream leaf********************************/
+// a handle: copies share the source and the current chunk. An lvalue
+// source is read through a reference and has to outlive the leaf, a
+// temporary one is kept by the leaf
+template<typename T>
+class chunk_stream{
+    struct state{
+        std::function<uint64_t(T*,uint64_t)> read;
+        std::shared_ptr<void> owned;
+        vector<T> buf;          // not std::vector, so bool has a buffer
+        T* p = nullptr;
+        uint64_t len = 0;
+        uint64_t tick = 0;
+    };
+    std::shared_ptr<state> s;
+
+    template<typename S>
+    void attach(S& src,std::true_type /*lvalue*/){
+        s->read = [&src](T* p,uint64_t n){ return static_cast<uint64_t>(src.read(p,n)); };
+    }
+    template<typename S>
+    void attach(S& src,std::false_type){
+        auto own = std::make_shared<S>(std::move(src));
+        S* p = own.get();
+        s->owned = own;
+        s->read = [p](T* out,uint64_t n){ return static_cast<uint64_t>(p->read(out,n)); };
+    }
+
+public:
+    using value_type = T;
+    using result_type = T;
+
+    template<typename S,typename = typename std::enable_if<!std::is_base_of<chunk_stream,typename std::decay<S>::type>::value&&
+                                                           stream_detail::is_source<typename std::decay<S>::type,T>::value>::type>
+    explicit chunk_stream(S&& src):s(std::make_shared<state>()){
+        attach(src,typename std::is_lvalue_reference<S>::type{});
+    }
+
+    uint64_t size(void) const{ return s->len; }
+
+    const T& operator[](uint64_t k) const{
+        if(k>=s->len){
+            throw std::out_of_range("subscript out of range");
+        }
+        return s->p[k];
+    }
+
+    const T* data(void) const{ return s->p; }
+
+    // the next chunk of up to n elements, unless this tick already read it;
+    // short reads are retried, so a short chunk means the source has ended
+    void fill(uint64_t tick,uint64_t n) const{
+        state& st = *s;
+        if(st.tick==tick) return;
+        st.tick = tick;
+        if(st.buf.size()!=n){
+            st.buf = vector<T>(n);
+            st.p = n==0 ? nullptr : &st.buf[0];
+        }
+        uint64_t got = 0;
+        while(got<n){
+            uint64_t m = st.read(st.p+got,n-got);
+            if(m==0) break;
+            got += m;
+        }
+        st.len = got;
+    }
+
+    using const_iterator = MyIterator<chunk_stream>;
+    const_iterator begin(void) const{ return const_iterator{*this,0}; }
+    const_iterator end(void) const{ return const_iterator{*this,size()}; }
+};
+
+template<typename T>
+using stream_valarray = Wrap<chunk_stream<T>>;
+
+// evaluate_into and apply() read the current chunk through its pointer
+namespace leaf_detail{
+    template<typename T>
+    struct reader<chunk_stream<T>>{
+        const T* p;
+        explicit reader(const chunk_stream<T>& x):p(x.data()){}
+        const T& operator[](uint64_t k) const{ return p[k]; }
+    };
+}
+namespace nary_detail{
+    template<typename T,typename R>
+    struct reader<chunk_stream<T>,R>{
+        const T* p;
+        explicit reader(const chunk_stream<T>& x):p(x.data()){}
+        R operator[](uint64_t k) const{ return static_cast<R>(p[k]); }
+    };
+}
+
+/*****************************refilling a tree********************************/
+namespace stream_detail{
+    // feed<V>::fill passes a refill down to every leaf of V; value tells
+    // whether V has a stream leaf at all
+    template<typename V>
+    struct feed:std::false_type{
+        static_assert(sizeof(V)==0,"a streamed expression can only hold stream leaves, scalars and element-wise nodes");
+    };
+    template<typename V>
+    struct feed<Wrap<V>>:feed<V>{};
+    template<typename T>
+    struct feed<chunk_stream<T>>:std::true_type{
+        static void fill(const chunk_stream<T>& x,uint64_t tick,uint64_t n){ x.fill(tick,n); }
+    };
+    template<typename T>
+    struct feed<ScalarWrapper<T>>:std::false_type{
+        static void fill(const ScalarWrapper<T>&,uint64_t,uint64_t){}
+    };
+    template<typename V1,typename V2,typename Op>
+    struct feed<BinaryProxy<V1,V2,Op>>:std::integral_constant<bool,feed<V1>::value||feed<V2>::value>{
+        static void fill(const BinaryProxy<V1,V2,Op>& x,uint64_t tick,uint64_t n){
+            feed<V1>::fill(x.v1,tick,n);
+            feed<V2>::fill(x.v2,tick,n);
+        }
+    };
+    template<typename V,typename Op>
+    struct feed<UnaryProxy<V,Op>>:feed<V>{
+        static void fill(const UnaryProxy<V,Op>& x,uint64_t tick,uint64_t n){
+            feed<V>::fill(x.v,tick,n);
+        }
+    };
+    template<typename M,typename A,typename B>
+    struct feed<SelectProxy<M,A,B>>:std::integral_constant<bool,feed<M>::value||feed<A>::value||feed<B>::value>{
+        static void fill(const SelectProxy<M,A,B>& x,uint64_t tick,uint64_t n){
+            feed<M>::fill(x.m,tick,n);
+            feed<A>::fill(x.a,tick,n);
+            feed<B>::fill(x.b,tick,n);
+        }
+    };
+    template<typename Op,typename... Vs>
+    struct feed<NaryProxy<Op,Vs...>>:std::integral_constant<bool,(feed<Vs>::value||...)>{
+        static void fill(const NaryProxy<Op,Vs...>& x,uint64_t tick,uint64_t n){
+            fill(x,tick,n,std::index_sequence_for<Vs...>{});
+        }
+        template<std::size_t... I>
+        static void fill(const NaryProxy<Op,Vs...>& x,uint64_t tick,uint64_t n,std::index_sequence<I...>){
+            (feed<Vs>::fill(std::get<I>(x.xs),tick,n),...);
+        }
+    };
+
+    // the current chunk of x into out, as assignment would do it
+    template<typename R,typename V>
+    void evaluate(R* out,const V& x,uint64_t n,std::true_type /*evaluate_into*/){
+        x.evaluate_into(out,n);
+    }
+    template<typename R,typename V>
+    void evaluate(R* out,const V& x,uint64_t n,std::false_type){
+        leaf_detail::reader<V> r(x);
+        for(uint64_t k = 0;k<n;k++){
+            out[k] = static_cast<R>(r[k]);
+        }
+    }
+
+    template<typename R,typename V>
+    using result = typename std::conditional<std::is_void<R>::value,typename V::value_type,R>::type;
+
+    template<typename Acc>
+    struct summer{
+        Acc total = Acc(0);
+        template<typename R>
+        void write(const R* p,uint64_t n){
+            total += reduce_detail::sum<Acc>(n,[p](uint64_t k){ return p[k]; });
+        }
+    };
+}
+
+/*****************************stream_to********************************/
+// runs x over its sources chunk by chunk into sink.write(const R*,n), R
+// being x's value type unless given; returns the number of elements written
+template<typename R = void,typename Sink,typename V>
+uint64_t stream_to(Sink& sink,const Wrap<V>& x,uint64_t chunk = stream_detail::default_chunk){
+    using Out = stream_detail::result<R,V>;
+    static_assert(stream_detail::feed<V>::value,"stream_to needs an expression with a stream leaf");
+    if(chunk==0){
+        throw std::invalid_argument("stream chunk of length 0");
+    }
+    const V& tree = x;
+    // epl::vector, a std::vector<bool> would have no buffer to write
+    vector<Out> out(chunk);
+    Out* buf = &out[0];
+    uint64_t total = 0;
+    for(;;){
+        stream_detail::feed<V>::fill(tree,stream_detail::next_tick(),chunk);
+        uint64_t n = std::min<uint64_t>(tree.size(),chunk);
+        if(n==0) break;
+        stream_detail::evaluate(buf,tree,n,typename assign_detail::evaluates_into<V,Out>::type{});
+        sink.write(buf,n);
+        total += n;
+        if(n<chunk) break;
+    }
+    return total;
+}
+
+// the sum of x over all of its sources, each chunk added up as sum() would
+template<typename Acc = void,typename V>
+stream_detail::result<Acc,V> stream_sum(const Wrap<V>& x,uint64_t chunk = stream_detail::default_chunk){
+    using R = stream_detail::result<Acc,V>;
+    stream_detail::summer<R> s;
+    stream_to<R>(s,x,chunk);
+    return s.total;
+}
+
+#endif /* _stream_h */
@@ -20,6 +20,24 @@
 #include <algorithm>
 #include "Vector.h"
 #include <complex>
+#include <charconv>
+#include <system_error>
+#include <stdexcept>
+#include <string>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
 
 using std::complex;
 //using std::vector; // during development and testing
@@ -32,6 +50,10 @@ template<typename T1,typename T2,typename Op>
 class BinaryProxy;
 template<typename T,typename Op>
 class UnaryProxy;
+template<typename T>
+struct Wrap;
+template<typename T,uint64_t N>
+class static_array;
 
 
 template<bool B,class T = void> struct operation_enable_if{};
@@ -44,40 +66,54 @@ template<class T>  struct operation_enable_if<false,T>{};
 
 
 /****************************for function overload *********************************************/
-template<typename T> struct Is_Scalar;
-template<> struct Is_Scalar<int>{using type = int;};
-template<> struct Is_Scalar<double>{using type = double;};
-template<> struct Is_Scalar<float>{using type = float;};
-template<> struct Is_Scalar<complex<double>>{using type = complex<double>;};
-template<> struct Is_Scalar<complex<float>>{using type = complex<float>;};
+template<typename T> struct Is_Scalar:operation_enable_if<SRank<T>::value!=0,T>{};
 
 /************************************choose type*****************************************************/
-
-
-template<typename T> struct SRank{static constexpr int value = 0;static constexpr bool flag = false;};
-template<>struct SRank<int>{ static constexpr int value = 1;static constexpr bool flag = false;};
-template<>struct SRank<float>{static constexpr int value = 2;static constexpr bool flag = false;};
-template<>struct SRank<double>{static constexpr int value = 3;static constexpr bool flag = false;};
+// value is nonzero for every arithmetic type and complex of one, flag marks
+// complex, type is the real type underneath
+template<typename T> struct SRank{
+    static constexpr int value = std::is_arithmetic<T>::value ? 1 : 0;
+    static constexpr bool flag = false;
+    using type = T;
+};
 template<typename T>
-struct SRank<complex<T>>{static constexpr int value = SRank<T>::value; static constexpr bool flag = true;};
+struct SRank<complex<T>>{static constexpr int value = SRank<T>::value; static constexpr bool flag = true; using type = T;};
 
+// #define VALARRAY_NO_WIDENING before including this file to keep narrow
+// integers narrow: int16_t+int16_t stays int16_t instead of becoming int
+#ifdef VALARRAY_NO_WIDENING
+static constexpr bool valarray_widening = false;
+#else
+static constexpr bool valarray_widening = true;
+#endif
 
-template<int>struct SType;
-template<>struct SType<1>{using type = int;};
-template<>struct SType<2>{using type = float;};
-template<>struct SType<3>{using type = double;};
+// the usual arithmetic conversions: int8_t+int8_t is int, int+unsigned is
+// unsigned, int64_t+float is float, anything with long double is long double
+template<typename T1,typename T2,bool widen>
+struct promote_real{
+    using type = decltype(std::declval<T1>()+std::declval<T2>());
+};
+// no widening: between two integers the wider one wins, at equal width the
+// unsigned one; bool and floating point convert as usual
+template<typename T1,typename T2>
+struct promote_real<T1,T2,false>{
+    static constexpr bool as_usual = !std::is_integral<T1>::value||!std::is_integral<T2>::value
+                                     ||std::is_same<T1,bool>::value||std::is_same<T2,bool>::value;
+    using narrow = typename std::conditional<(sizeof(T1)>sizeof(T2)),T1,
+                   typename std::conditional<(sizeof(T2)>sizeof(T1)),T2,
+                   typename std::conditional<std::is_unsigned<T1>::value,T1,T2>::type>::type>::type;
+    using type = typename std::conditional<as_usual,decltype(std::declval<T1>()+std::declval<T2>()),narrow>::type;
+};
 
 template<typename T, bool is_complex> struct CType;
 template<typename T> struct CType<T,false>{using type = T;};
 template<typename T> struct CType<T,true>{using type =complex<T>;};
 
-template <typename T1,typename T2>
+template <typename T1,typename T2,bool widen = valarray_widening>
 struct choose_type{
-    static constexpr int t1_rank = SRank<T1>::value;
-    static constexpr int t2_rank = SRank<T2>::value;
-    static constexpr int max_rank = (t1_rank > t2_rank)? t1_rank: t2_rank;
     static constexpr bool is_complex = SRank<T1>::flag||SRank<T2>::flag;
-    using type = typename CType<typename SType<max_rank>::type,is_complex>::type;
+    using real_type = typename promote_real<typename SRank<T1>::type,typename SRank<T2>::type,widen>::type;
+    using type = typename CType<real_type,is_complex>::type;
 };
 
 
@@ -85,9 +121,24 @@ template <typename T1,typename T2>
 using ChooseType = typename choose_type<T1,T2>::type;
 
 template<typename T>struct is_complex{static constexpr bool flag = false;};
-template<> struct is_complex<complex<int>>{static constexpr bool flag = true;};
-template<> struct is_complex<complex<float>>{static constexpr bool flag = true;};
-template<> struct is_complex<complex<double>>{static constexpr bool flag = true;};
+template<typename T> struct is_complex<complex<T>>{static constexpr bool flag = true;};
+
+/**********************************static extent***************************************************/
+// size known at compile time: 0 when it is only known at run time, a scalar
+// is as long as whatever it is combined with
+static constexpr uint64_t any_extent = std::numeric_limits<uint64_t>::max();
+
+template<typename V> struct static_extent:std::integral_constant<uint64_t,0>{};
+template<typename T,uint64_t N> struct static_extent<static_array<T,N>>:std::integral_constant<uint64_t,N>{};
+template<typename T> struct static_extent<ScalarWrapper<T>>:std::integral_constant<uint64_t,any_extent>{};
+template<typename T> struct static_extent<Wrap<T>>:static_extent<T>{};
+template<typename V,typename Op> struct static_extent<UnaryProxy<V,Op>>:static_extent<V>{};
+template<typename V1,typename V2,typename Op>
+struct static_extent<BinaryProxy<V1,V2,Op>>{
+    static constexpr uint64_t e1 = static_extent<V1>::value;
+    static constexpr uint64_t e2 = static_extent<V2>::value;
+    static constexpr uint64_t value = (e1==0||e2==0) ? 0 : (e1<e2 ? e1 : e2);
+};
 
 /**********************************choose ref or not***************************************************/
 template<typename T>
@@ -100,6 +151,11 @@ struct chooseRef<vector<T>>{
     using type = vector<T> const&;
 };
 
+template<typename T,uint64_t N>
+struct chooseRef<static_array<T,N>>{
+    using type = static_array<T,N> const&;
+};
+
 template<typename T>
 using ChooseRef = typename chooseRef<T>::type;
 
@@ -107,23 +163,30 @@ using ChooseRef = typename chooseRef<T>::type;
 
 template<typename Proxy>
 class MyIterator{
-    const Proxy parent;
+    // the expression is pointed at, not copied: begin() and end() stay
+    // cheap however deep the proxy tree is, but an iterator must not
+    // outlive the expression it came from
+    const Proxy* parent;
     uint64_t index;
 public:
     using iterator_category = std::random_access_iterator_tag;
     //using T = typename Proxy::value_type;
     using T = typename Proxy::result_type;
-    using difference_type = uint64_t;
-    using value_type = const T;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
     using pointer = const T*;
     using reference = const T; // must be value!!!!!!!! cannot be reference,
     
-    MyIterator(const Proxy& _parent,const uint64_t _index):parent(_parent),index(_index){    }
+    MyIterator(void):parent(nullptr),index(0){}
+    MyIterator(const Proxy& _parent,const uint64_t _index):parent(&_parent),index(_index){    }
     
     
     
     reference operator*(void) const{
-        return parent[index];
+        return (*parent)[index];
+    }
+    reference operator[](difference_type k) const{
+        return (*parent)[index+k];
     }
     
     MyIterator& operator++(void) { // pre ++
@@ -136,11 +199,17 @@ public:
         operator++(); // increment myself
         return t;
     }
-    MyIterator operator+(difference_type k) {
+    MyIterator& operator+=(difference_type k){
+        index += k;
+        return *this;
+    }
+    MyIterator operator+(difference_type k) const{
         MyIterator t{*this};
-        t.index = index+k;
+        t += k;
         return t;
-        
+    }
+    friend MyIterator operator+(difference_type k,const MyIterator& it){
+        return it+k;
     }
     
     
@@ -155,11 +224,17 @@ public:
         operator--(); // increment myself
         return t;
     }
-    MyIterator operator-(difference_type k) {
+    MyIterator& operator-=(difference_type k){
+        index -= k;
+        return *this;
+    }
+    MyIterator operator-(difference_type k) const{
         MyIterator t{*this};
-        t.index = index - k;
+        t -= k;
         return t;
-        
+    }
+    difference_type operator-(const MyIterator& rhs) const{
+        return static_cast<difference_type>(index)-static_cast<difference_type>(rhs.index);
     }
     
     bool operator==(const MyIterator & rhs) const {
@@ -176,13 +251,10 @@ public:
         return index<rhs.index;
     }
     bool operator>(MyIterator const& rhs)const{
-        rhs.check_invalid();
         return index>rhs.index;
     }
     bool operator<=(MyIterator const& rhs)const{
-        
-        rhs.check_invalid();
-        return !(*this>rhs);
+        return index<=rhs.index;
     }
     
     bool operator>=(MyIterator const& rhs)const{
@@ -194,31 +266,84 @@ public:
     
 };
 
+// an empty functor takes no room in a node: it is held as a base rather
+// than a member, so copying a deep tree copies little more than its leaves
+template<typename Op,bool empty = std::is_empty<Op>::value&&!std::is_final<Op>::value>
+struct op_holder{
+    Op op;
+    explicit op_holder(const Op& o):op(o){}
+    const Op& operation() const{ return op; }
+};
+template<typename Op>
+struct op_holder<Op,true>:private Op{
+    explicit op_holder(const Op& o):Op(o){}
+    const Op& operation() const{ return *this; }
+};
+
+// evaluate_into reads a tree of these nodes through a mirror of it with
+// raw pointers for the vector leaves, defined once the leaf types are complete.
+// An unoptimized build would not inline the mirror anyway, so there the
+// loop reads the tree itself and no mirror types reach the debug info
+namespace leaf_detail{
+    template<typename V> struct reader;
+    template<typename V> struct indexed;
+#if defined(__OPTIMIZE__)
+    template<typename V> using loop = reader<V>;
+#else
+    template<typename V> using loop = indexed<V>;
+#endif
+}
+
+// the reader's operator[] nests as deep as the tree; past about 16 levels
+// GCC stops inlining it and the loop calls a chain of small functions, so
+// the whole mirror is inlined into the loop that walks it
+#if defined(__GNUC__)
+#define VALARRAY_FLATTEN __attribute__((flatten))
+#else
+#define VALARRAY_FLATTEN
+#endif
+
+// comparisons (and && / || of masks) yield bool masks, every other op the
+// promoted type of its operands
+template<typename V1,typename V2,typename Op>
+using binary_value = typename std::conditional<std::is_same<typename Op::result_type,bool>::value,bool,
+                                               typename choose_type<typename V1::value_type,typename V2::value_type>::type>::type;
+
 /**********************BinaryProxy**********************************************/
 template<typename V1Type, typename V2Type, typename Op>
-class BinaryProxy{
+class BinaryProxy:public op_holder<Op>{
 public:
     using LeftType = ChooseRef<V1Type>;
     using RightType = ChooseRef<V2Type>;
     LeftType v1;
     RightType v2;
-    Op op;
-    using value_type = typename choose_type<typename V1Type::value_type,typename V2Type::value_type>::type;
+    using value_type = binary_value<V1Type,V2Type,Op>;
     using result_type = value_type;
     
 public:
     
     
-    BinaryProxy(V1Type const& lhs, V2Type const& rhs,Op operation):v1(lhs),v2(rhs),op(operation){}
-    
-    BinaryProxy(const BinaryProxy& that):v1(that.v1),v2(that.v2),op(that.op){}
+    BinaryProxy(V1Type const& lhs, V2Type const& rhs,Op operation):op_holder<Op>(operation),v1(lhs),v2(rhs){}
+    // kept user-provided: a trivially copyable tree has every level's
+    // copy of its subtree inlined into the caller, about 3x the code at depth 32
+    BinaryProxy(const BinaryProxy& that):op_holder<Op>(that),v1(that.v1),v2(that.v2){}
     
     uint64_t size() const{
-        return std::min(v1.size(),v2.size());
+        constexpr uint64_t extent = static_extent<BinaryProxy>::value;
+        return extent!=0 ? extent : std::min(v1.size(),v2.size());
     }
     
     typename Op::result_type operator[](uint64_t k)const{
-        return op(v1[k],v2[k]);
+        return this->operation()(v1[k],v2[k]);
+    }
+    
+    // the whole tree in one loop; k < n is inside every leaf
+    template<typename T>
+    VALARRAY_FLATTEN void evaluate_into(T* out,uint64_t n) const{
+        leaf_detail::loop<BinaryProxy> r(*this);
+        for(uint64_t k = 0;k<n;k++){
+            out[k] = static_cast<T>(r[k]);
+        }
     }
     
     using const_iterator = MyIterator<BinaryProxy>;
@@ -235,22 +360,37 @@ public:
 };
 /**********************UnaryProxy**********************************************/
 template<typename T,typename Op>
-class UnaryProxy{
+class UnaryProxy:public op_holder<Op>{
 public:
     using Type = ChooseRef<T>;
     Type v;
-    Op op;
     using value_type = typename T::value_type;
     using result_type = ChooseType<typename T::value_type,typename Op::result_type>;
     
 public:
     
     
-    UnaryProxy(T const& _v,Op operation):v(_v),op(operation){}
-    UnaryProxy(const UnaryProxy& that):v(that.v),op(that.op){}
+    UnaryProxy(T const& _v,Op operation):op_holder<Op>(operation),v(_v){}
+    UnaryProxy(const UnaryProxy& that):op_holder<Op>(that),v(that.v){}
     uint64_t size()const{return v.size();}
     result_type operator[](uint64_t k)const{
-        return op(v[k]);
+        return this->operation()(v[k]);
+    }
+    template<typename U>
+    VALARRAY_FLATTEN void evaluate_into(U* out,uint64_t n) const{
+        leaf_detail::loop<UnaryProxy> r(*this);
+        for(uint64_t k = 0;k<n;k++){
+            out[k] = static_cast<U>(r[k]);
+        }
+    }
+    // over an N-D operand the shape carries through unchanged
+    template<typename V = T>
+    auto shape()const->decltype(std::declval<const V&>().shape()){
+        return v.shape();
+    }
+    template<typename I>
+    result_type at(const I& i)const{
+        return this->operation()(v.at(i));
     }
     
     using const_iterator = MyIterator<UnaryProxy>;
@@ -290,10 +430,428 @@ struct Sqrt{
     
     using result_type = ChooseType<T,double>;
     result_type operator()(T val)const{
+        using std::sqrt;    // long double and integers need the std overloads
         return sqrt(val);
     }
 
 };
+/*****************************N-D views************************************************/
+// shape/stride views over epl::vector storage, and broadcasting between
+// them the NumPy way: shapes are lined up from the last dimension, and a
+// dimension of 1 (or one a shorter operand does not have) stretches to
+// match the other side. A plain 1-D valarray counts as a row, a scalar
+// has no dimensions at all. Elements are visited in row-major order
+// wherever a flat index is needed (operator[], sum, printing).
+template<uint64_t D>
+using nd_shape = std::array<uint64_t,D>;
+template<uint64_t D>
+using nd_index = std::array<uint64_t,D>;
+
+template<typename T,uint64_t D>
+class ndview;
+template<typename V1,typename V2,typename Op>
+class nd_binary;
+template<typename V,uint64_t D>
+class reshaped;
+
+// 0 for anything without a shape()
+template<typename V> struct nd_rank:std::integral_constant<uint64_t,0>{};
+template<typename T,uint64_t D> struct nd_rank<ndview<T,D>>:std::integral_constant<uint64_t,D>{};
+template<typename V1,typename V2,typename Op> struct nd_rank<nd_binary<V1,V2,Op>>:std::integral_constant<uint64_t,nd_binary<V1,V2,Op>::rank>{};
+template<typename V,uint64_t D> struct nd_rank<reshaped<V,D>>:std::integral_constant<uint64_t,D>{};
+template<typename V,typename Op> struct nd_rank<UnaryProxy<V,Op>>:nd_rank<V>{};
+template<typename T> struct nd_rank<Wrap<T>>:nd_rank<T>{};
+
+namespace nd_detail{
+    template<uint64_t D>
+    uint64_t count(const nd_shape<D>& dims){
+        uint64_t n = 1;
+        for(uint64_t d = 0;d<D;d++){
+            n *= dims[d];
+        }
+        return n;
+    }
+
+    // flat row-major position back to an index
+    template<uint64_t D>
+    nd_index<D> unravel(uint64_t k,const nd_shape<D>& dims){
+        nd_index<D> i{};
+        for(uint64_t d = D;d>0;d--){
+            i[d-1] = k%dims[d-1];
+            k /= dims[d-1];
+        }
+        return i;
+    }
+
+    template<uint64_t D>
+    uint64_t ravel(const nd_index<D>& i,const nd_shape<D>& dims){
+        uint64_t k = 0;
+        for(uint64_t d = 0;d<D;d++){
+            k = k*dims[d]+i[d];
+        }
+        return k;
+    }
+
+    // the index an operand of shape dims sees when the whole expression is at i
+    template<uint64_t C,uint64_t D>
+    nd_index<C> align(const nd_index<D>& i,const nd_shape<C>& dims){
+        nd_index<C> j{};
+        for(uint64_t c = 0;c<C;c++){
+            j[c] = dims[c]==1 ? 0 : i[D-C+c];
+        }
+        return j;
+    }
+
+    // how each kind of operand is seen from an N-D expression
+    template<typename V,int kind = (nd_rank<V>::value!=0) ? 2 : 1>
+    struct operand{        // 1-D: a row along the last dimension
+        static constexpr uint64_t rank = 1;
+        static nd_shape<1> shape(const V& v){ return nd_shape<1>{v.size()}; }
+        static auto get(const V& v,const nd_index<1>& i)->decltype(v[0]){ return v[i[0]]; }
+    };
+    template<typename V>
+    struct operand<V,2>{
+        static constexpr uint64_t rank = nd_rank<V>::value;
+        static nd_shape<rank> shape(const V& v){ return v.shape(); }
+        static auto get(const V& v,const nd_index<rank>& i)->decltype(v.at(i)){ return v.at(i); }
+    };
+    template<typename T>
+    struct operand<ScalarWrapper<T>,1>{
+        static constexpr uint64_t rank = 0;
+        static nd_shape<0> shape(const ScalarWrapper<T>&){ return nd_shape<0>{}; }
+        static T get(const ScalarWrapper<T>& v,const nd_index<0>&){ return v[0]; }
+    };
+    template<typename T>
+    struct operand<Wrap<T>,1>:operand<T>{};
+
+    // throws unless a shape of C dimensions stretches to dims
+    template<uint64_t C,uint64_t D>
+    void check_broadcast(const nd_shape<C>& from,const nd_shape<D>& dims){
+        static_assert(C<=D,"operand has more dimensions than the result");
+        for(uint64_t c = 0;c<C;c++){
+            if(from[c]!=1&&from[c]!=dims[D-C+c]){
+                throw std::invalid_argument("shapes cannot be broadcast together");
+            }
+        }
+    }
+
+    // advances i to the next row-major index, false after the last one
+    template<uint64_t D>
+    bool next(nd_index<D>& i,const nd_shape<D>& dims){
+        for(uint64_t d = D;d>0;d--){
+            if(++i[d-1]<dims[d-1]) return true;
+            i[d-1] = 0;
+        }
+        return false;
+    }
+}
+
+/**********************ndview**********************************************/
+// a window onto elements owned by someone else, like an iterator it is
+// invalidated when the vector underneath reallocates; T may be const
+template<typename T,uint64_t D>
+class ndview{
+    T* base;
+    nd_shape<D> dims;
+    std::array<int64_t,D> steps;      // in elements, may be negative
+
+public:
+    using value_type = typename std::remove_const<T>::type;
+    static constexpr uint64_t rank = D;
+
+    ndview(T* p,const nd_shape<D>& shape,const std::array<int64_t,D>& stride):base(p),dims(shape),steps(stride){}
+
+    // row-major over the front of v
+    template<typename V>
+    ndview(V& v,const nd_shape<D>& shape):dims(shape){
+        uint64_t n = nd_detail::count(shape);
+        if(n>v.size()){
+            throw std::out_of_range("shape is larger than the vector");
+        }
+        base = n ? &v[0] : nullptr;
+        int64_t step = 1;
+        for(uint64_t d = D;d>0;d--){
+            steps[d-1] = step;
+            step *= static_cast<int64_t>(shape[d-1]);
+        }
+    }
+
+    const nd_shape<D>& shape(void) const{ return dims; }
+    const std::array<int64_t,D>& stride(void) const{ return steps; }
+    T* data(void) const{ return base; }
+    uint64_t size(void) const{ return nd_detail::count(dims); }
+
+    T& at(const nd_index<D>& i) const{
+        int64_t offset = 0;
+        for(uint64_t d = 0;d<D;d++){
+            if(i[d]>=dims[d]){
+                throw std::out_of_range("subscript ouf of range");
+            }
+            offset += static_cast<int64_t>(i[d])*steps[d];
+        }
+        return base[offset];
+    }
+
+    T& operator[](uint64_t k) const{
+        if(k>=size()){
+            throw std::out_of_range("subscript ouf of range");
+        }
+        return at(nd_detail::unravel(k,dims));
+    }
+
+    /*****************************sub views********************************/
+    // every element along dimension dim from first up to (not including)
+    // last, step apart
+    Wrap<ndview> slice(uint64_t dim,uint64_t first,uint64_t last,uint64_t step = 1) const{
+        if(dim>=D||first>last||last>dims[dim]||step==0){
+            throw std::out_of_range("bad slice");
+        }
+        ndview r{*this};
+        r.base = (first<last) ? base+static_cast<int64_t>(first)*steps[dim] : base;
+        r.dims[dim] = (last-first+step-1)/step;
+        r.steps[dim] = steps[dim]*static_cast<int64_t>(step);
+        return Wrap<ndview>{r};
+    }
+
+    // fixes the first index: a row of a matrix, a plane of a volume
+    template<uint64_t E = D>
+    typename operation_enable_if<(E>1),Wrap<ndview<T,D-1>>>::type operator()(uint64_t i) const{
+        if(i>=dims[0]){
+            throw std::out_of_range("subscript ouf of range");
+        }
+        nd_shape<D-1> shape;
+        std::array<int64_t,D-1> stride;
+        for(uint64_t d = 1;d<D;d++){
+            shape[d-1] = dims[d];
+            stride[d-1] = steps[d];
+        }
+        return Wrap<ndview<T,D-1>>{ndview<T,D-1>{base+static_cast<int64_t>(i)*steps[0],shape,stride}};
+    }
+
+    Wrap<ndview> transpose(uint64_t d1 = 0,uint64_t d2 = D-1) const{
+        if(d1>=D||d2>=D){
+            throw std::out_of_range("bad transpose");
+        }
+        ndview r{*this};
+        std::swap(r.dims[d1],r.dims[d2]);
+        std::swap(r.steps[d1],r.steps[d2]);
+        return Wrap<ndview>{r};
+    }
+
+    using const_iterator = MyIterator<ndview>;
+    const_iterator begin(void) const{ return const_iterator{*this,0}; }
+    const_iterator end(void) const{ return const_iterator{*this,size()}; }
+};
+
+/**********************nd_binary**********************************************/
+// BinaryProxy with a shape: the operands are broadcast against each other
+// when the node is built, and each element reads both at the aligned index
+template<typename V1,typename V2,typename Op>
+class nd_binary{
+    using left = nd_detail::operand<V1>;
+    using right = nd_detail::operand<V2>;
+public:
+    static constexpr uint64_t rank = left::rank>right::rank ? left::rank : right::rank;
+    using LeftType = ChooseRef<V1>;
+    using RightType = ChooseRef<V2>;
+    LeftType v1;
+    RightType v2;
+    Op op;
+    using value_type = binary_value<V1,V2,Op>;
+    using result_type = value_type;
+
+private:
+    nd_shape<left::rank> ldims;
+    nd_shape<right::rank> rdims;
+    nd_shape<rank> dims;
+
+public:
+    nd_binary(V1 const& lhs,V2 const& rhs,Op operation)
+        :v1(lhs),v2(rhs),op(operation),ldims(left::shape(lhs)),rdims(right::shape(rhs)){
+        dims.fill(1);
+        stretch(ldims);
+        stretch(rdims);
+    }
+
+    const nd_shape<rank>& shape(void) const{ return dims; }
+    uint64_t size(void) const{ return nd_detail::count(dims); }
+
+    typename Op::result_type at(const nd_index<rank>& i) const{
+        return op(left::get(v1,nd_detail::align(i,ldims)),right::get(v2,nd_detail::align(i,rdims)));
+    }
+
+    typename Op::result_type operator[](uint64_t k) const{
+        return at(nd_detail::unravel(k,dims));
+    }
+
+    using const_iterator = MyIterator<nd_binary>;
+    const_iterator begin(void) const{ return const_iterator{*this,0}; }
+    const_iterator end(void) const{ return const_iterator{*this,size()}; }
+
+private:
+    template<uint64_t C>
+    void stretch(const nd_shape<C>& from){
+        for(uint64_t c = 0;c<C;c++){
+            uint64_t& to = dims[rank-C+c];
+            if(to==1){
+                to = from[c];
+            }else if(from[c]!=1&&from[c]!=to){
+                throw std::invalid_argument("shapes cannot be broadcast together");
+            }
+        }
+    }
+};
+
+/**********************reshaped**********************************************/
+// any 1-D expression read row-major as shape, e.g. {n,1} for a column
+template<typename V,uint64_t D>
+class reshaped{
+public:
+    using Type = ChooseRef<V>;
+    Type v;
+    using value_type = typename V::value_type;
+    static constexpr uint64_t rank = D;
+
+private:
+    nd_shape<D> dims;
+
+public:
+    reshaped(V const& src,const nd_shape<D>& shape):v(src),dims(shape){
+        if(nd_detail::count(shape)!=src.size()){
+            throw std::invalid_argument("reshape changes the number of elements");
+        }
+    }
+
+    const nd_shape<D>& shape(void) const{ return dims; }
+    uint64_t size(void) const{ return v.size(); }
+
+    auto at(const nd_index<D>& i) const->decltype(v[0]){
+        return v[nd_detail::ravel(i,dims)];
+    }
+    auto operator[](uint64_t k) const->decltype(v[0]){
+        return v[k];
+    }
+
+    using const_iterator = MyIterator<reshaped>;
+    const_iterator begin(void) const{ return const_iterator{*this,0}; }
+    const_iterator end(void) const{ return const_iterator{*this,size()}; }
+};
+
+/*****************************reduction************************************************/
+namespace reduce_detail{
+    static constexpr uint64_t lanes = 8;
+
+    // eight independent partial sums instead of one running total: the adds
+    // no longer wait on each other and the compiler can keep the partials in
+    // vector registers without having to reassociate floating point itself
+    template<typename Acc,typename Get>
+    Acc sum(uint64_t n,Get get){
+        Acc part[lanes];
+        for(uint64_t j = 0;j<lanes;j++){
+            part[j] = Acc(0);
+        }
+        uint64_t blocks = n/lanes;
+        for(uint64_t b = 0;b<blocks;b++){
+            for(uint64_t j = 0;j<lanes;j++){
+                part[j] += static_cast<Acc>(get(b*lanes+j));
+            }
+        }
+        for(uint64_t j = 0;j<n%lanes;j++){
+            part[j] += static_cast<Acc>(get(blocks*lanes+j));
+        }
+        for(uint64_t j = 1;j<lanes;j++){
+            part[0] += part[j];
+        }
+        return part[0];
+    }
+}
+/*****************************assignment************************************************/
+namespace assign_detail{
+    // longer static expressions are left to the compiler to unroll or not
+    static constexpr uint64_t unroll_limit = 64;
+
+    template<typename Dst,typename Src,uint64_t... K>
+    void unrolled(Dst& dst,const Src& src,std::integer_sequence<uint64_t,K...>){
+        using V = typename Dst::value_type;
+        ((dst[K] = static_cast<V>(src[K])),...);
+    }
+
+    template<typename Dst,typename Src>
+    void loop(Dst& dst,const Src& src,uint64_t n){
+        using V = typename Dst::value_type;
+        for(uint64_t k = 0;k<n;k++){
+            dst[k] = static_cast<V>(src[k]);
+        }
+    }
+
+    template<uint64_t N,typename Dst,typename Src>
+    void fixed(Dst& dst,const Src& src,std::true_type){
+        unrolled(dst,src,std::make_integer_sequence<uint64_t,N>{});
+    }
+    template<uint64_t N,typename Dst,typename Src>
+    void fixed(Dst& dst,const Src& src,std::false_type){
+        loop(dst,src,N);
+    }
+
+    // both sides static: the count is a constant and no size() is called
+    template<typename Dst,typename Src>
+    void assign(Dst& dst,const Src& src,std::true_type){
+        constexpr uint64_t d = static_extent<Dst>::value;
+        constexpr uint64_t s = static_extent<Src>::value;
+        constexpr uint64_t n = d<s ? d : s;
+        fixed<n>(dst,src,std::integral_constant<bool,(n<=unroll_limit)>{});
+    }
+    // a source with evaluate_into(V* out,n) writes a plain vector's buffer
+    // itself, in whatever blocks or packs suit it
+    template<typename Src,typename V,typename = void>
+    struct evaluates_into:std::false_type{};
+    template<typename Src,typename V>
+    struct evaluates_into<Src,V,decltype(std::declval<const Src&>().evaluate_into(std::declval<V*>(),uint64_t()),void())>:std::true_type{};
+
+    template<typename Dst,typename Src>
+    using direct = std::integral_constant<bool,std::is_base_of<vector<typename Dst::value_type>,Dst>::value&&
+                                               evaluates_into<Src,typename Dst::value_type>::value>;
+
+    template<typename Dst,typename Src>
+    void run(Dst& dst,const Src& src,uint64_t n,std::true_type /*direct*/){
+        if(n!=0) src.evaluate_into(&dst[0],n);
+    }
+    template<typename Dst,typename Src>
+    void run(Dst& dst,const Src& src,uint64_t n,std::false_type){
+        loop(dst,src,n);
+    }
+
+    template<typename Dst,typename Src>
+    void assign(Dst& dst,const Src& src,std::false_type){
+        run(dst,src,std::min<uint64_t>(dst.size(),src.size()),typename direct<Dst,Src>::type{});
+    }
+
+    // an N-D destination takes src broadcast to its own shape
+    template<typename Dst,typename Src>
+    void assign_nd(Dst& dst,const Src& src,std::true_type){
+        using V = typename Dst::value_type;
+        using from = nd_detail::operand<Src>;
+        const auto& dims = dst.shape();
+        auto sdims = from::shape(src);
+        nd_detail::check_broadcast(sdims,dims);
+        if(nd_detail::count(dims)==0) return;
+        nd_index<nd_rank<Dst>::value> i{};
+        do{
+            dst.at(i) = static_cast<V>(from::get(src,nd_detail::align(i,sdims)));
+        }while(nd_detail::next(i,dims));
+    }
+    template<typename Dst,typename Src>
+    void assign_nd(Dst& dst,const Src& src,std::false_type){
+        assign(dst,src,std::integral_constant<bool,static_extent<Dst>::value!=0&&static_extent<Src>::value!=0>{});
+    }
+
+    // dst[k] = src[k] for every k both have
+    template<typename Dst,typename Src>
+    void assign(Dst& dst,const Src& src){
+        assign_nd(dst,src,std::integral_constant<bool,nd_rank<Dst>::value!=0>{});
+    }
+}
+
 /*****************************wrap************************************************/
 template<typename T>
 struct Wrap:public T{
@@ -305,19 +863,13 @@ public:
     
     template<typename RHS>
     Wrap(const Wrap<RHS> & that){ //x = y+z; LHS is Wrap<MyVector<T>>, RHS
-        for(auto val:that){
-            this->push_back(static_cast<typename T::value_type>(val));
-        }
+        construct_from(that,std::integral_constant<bool,static_extent<T>::value!=0>{});
     }
     
     /********************assignment to wrap<T> **********************/
     Wrap<T>& operator=(const Wrap<T>& that){
         if((void*)this!=(void*)&that){
-            uint64_t min_size = this->size() < that.size() ? this->size() : that.size();
-            for(uint64_t k = 0;k<min_size;k++){
-                (*this)[k] = static_cast<typename T::value_type>(that[k]);
-                
-            }
+            assign_detail::assign(*this,that);
         }
         return *this;
     }
@@ -326,18 +878,14 @@ public:
     template<typename RHS1>
     Wrap<T>& operator=(const Wrap<RHS1>& that){
         if((void*)this!=(void*)&that){
-            uint64_t min_size = this->size() < that.size() ? this->size() : that.size();
-            for(uint64_t k = 0;k<min_size;k++){
-                (*this)[k] = static_cast<typename T::value_type>(that[k]);
-                
-            }
+            assign_detail::assign(*this,that);
         }
         return *this;
     }
     
     /********************assignment with scalar **********************/
     template<typename RHS2>
-    typename std::enable_if<SRank<RHS2>::value,Wrap<T>>::type & operator=(const RHS2& that){
+    typename std::enable_if<SRank<RHS2>::value!=0,Wrap<T>>::type & operator=(const RHS2& that){
         for(uint64_t k = 0;k<this->size();k++){
             (*this)[k] = static_cast<typename T::value_type>(that);
             
@@ -346,17 +894,16 @@ public:
         return *this;
     }
     /****************************sum***********************************/
-    typename T::value_type sum(){
-//        typename T::value_type result = 0;
-//        for(uint64_t k = 0;k<this->size();k++){
-//            result+=(*this)[k];
-//        }
-//        return result;
-        return accumulate(std::plus<typename T::value_type>{});
+    // Acc is what the elements are added up in, e.g. x.sum<double>() for a
+    // valarray<float> or x.sum<int64_t>() for a valarray<int>; nothing is
+    // converted up front
+    template<typename Acc = typename T::value_type>
+    Acc sum() const{
+        return sum_of<Acc>(typename std::is_base_of<vector<typename T::value_type>,T>::type{});
     }
     /****************************accumulate*******************************/
     template<typename Op>
-    typename Op::result_type accumulate(Op op){
+    typename Op::result_type accumulate(Op op) const{
         if(this->size()<=0) return 0;
         typename Op::result_type result = (*this)[0];
         for(uint64_t k = 1;k<this->size();k++){
@@ -364,6 +911,16 @@ public:
         }
         return result;
     }
+    // same fold with every element converted to Acc first
+    template<typename Acc,typename Op>
+    Acc accumulate(Op op) const{
+        if(this->size()<=0) return Acc(0);
+        Acc result = static_cast<Acc>((*this)[0]);
+        for(uint64_t k = 1;k<this->size();k++){
+              result = op(static_cast<Acc>((*this)[k]),result);
+        }
+        return result;
+    }
     /*********************apply**********************/
     template<typename Op>
     Wrap<UnaryProxy<T,Op>> apply(Op op){
@@ -377,38 +934,210 @@ public:
         return  apply(Sqrt<typename T::value_type>{});
     }
     
-    
+private:
+    template<typename RHS>
+    void construct_from(const Wrap<RHS>& that,std::false_type){
+        grow_from(that,typename assign_detail::direct<Wrap,Wrap<RHS>>::type{});
+    }
+    template<typename RHS>
+    void grow_from(const Wrap<RHS>& that,std::false_type){
+        for(auto val:that){
+            this->push_back(static_cast<typename T::value_type>(val));
+        }
+    }
+    // sized up front, then written by the source itself
+    template<typename RHS>
+    void grow_from(const Wrap<RHS>& that,std::true_type){
+        T::operator=(T(that.size()));
+        assign_detail::run(*this,that,that.size(),std::true_type{});
+    }
+    // fixed size storage already exists, only the values are filled in
+    template<typename RHS>
+    void construct_from(const Wrap<RHS>& that,std::true_type){
+        assign_detail::assign(*this,that);
+    }
+
+    // a plain vector is read straight from its buffer, anything else
+    // (proxies, split_complex) through operator[]
+    template<typename Acc>
+    Acc sum_of(std::true_type) const{
+        if(this->size()==0) return Acc(0);
+        const typename T::value_type* p = &(*this)[0];
+        return reduce_detail::sum<Acc>(this->size(),[p](uint64_t k){ return p[k]; });
+    }
+    template<typename Acc>
+    Acc sum_of(std::false_type) const{
+        return reduce_detail::sum<Acc>(this->size(),[this](uint64_t k){ return (*this)[k]; });
+    }
 };
 template<typename T>
 using valarray = Wrap<vector<T>>;
 
+/*****************************static valarray************************************************/
+// inline storage and a size fixed at compile time, for the 3, 4 and 16
+// element vectors of geometry code; expressions made only of these (and
+// scalars) are evaluated fully unrolled
+template<typename T,uint64_t N>
+class static_array{
+    static_assert(N>0,"static_array needs at least one element");
+public:
+    T elems[N];
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    static_array(void):elems{}{}
+    static_array(std::initializer_list<T> list):elems{}{
+        if(list.size()>N){
+            throw std::out_of_range("too many initializers");
+        }
+        std::copy(list.begin(),list.end(),elems);
+    }
+
+    constexpr uint64_t size(void) const{ return N; }
+
+    T& operator[](uint64_t k){
+        if(k>=N){
+            throw std::out_of_range("subscript ouf of range");
+        }
+        return elems[k];
+    }
+    const T& operator[](uint64_t k) const{
+        if(k>=N){
+            throw std::out_of_range("subscript ouf of range");
+        }
+        return elems[k];
+    }
+
+    iterator begin(void){ return elems; }
+    iterator end(void){ return elems+N; }
+    const_iterator begin(void) const{ return elems; }
+    const_iterator end(void) const{ return elems+N; }
+};
+
+template<typename T,uint64_t N>
+using static_valarray = Wrap<static_array<T,N>>;
+
+
+/**********************leaf readers**********************************************/
+namespace leaf_detail{
+    // anything else is read through its own operator[]
+    template<typename V>
+    struct indexed{
+        const V& v;
+        explicit indexed(const V& x):v(x){}
+        auto operator[](uint64_t k) const->decltype(v[k]){ return v[k]; }
+    };
+    template<typename V>
+    struct reader:indexed<V>{
+        using indexed<V>::indexed;
+    };
+    template<typename T>
+    struct reader<vector<T>>{
+        const T* p;
+        explicit reader(const vector<T>& x):p(x.size()==0 ? nullptr : &x[0]){}
+        const T& operator[](uint64_t k) const{ return p[k]; }
+    };
+    template<typename T,uint64_t N>
+    struct reader<static_array<T,N>>{
+        const T* p;
+        explicit reader(const static_array<T,N>& x):p(x.elems){}
+        const T& operator[](uint64_t k) const{ return p[k]; }
+    };
+    template<typename T>
+    struct reader<ScalarWrapper<T>>{
+        T c;
+        explicit reader(const ScalarWrapper<T>& x):c(x[0]){}
+        T operator[](uint64_t) const{ return c; }
+    };
+    template<typename V1,typename V2,typename Op>
+    struct reader<BinaryProxy<V1,V2,Op>>:op_holder<Op>{
+        reader<V1> a;
+        reader<V2> b;
+        explicit reader(const BinaryProxy<V1,V2,Op>& x):op_holder<Op>(x.operation()),a(x.v1),b(x.v2){}
+        typename Op::result_type operator[](uint64_t k) const{ return this->operation()(a[k],b[k]); }
+    };
+    template<typename V,typename Op>
+    struct reader<UnaryProxy<V,Op>>:op_holder<Op>{
+        reader<V> a;
+        explicit reader(const UnaryProxy<V,Op>& x):op_holder<Op>(x.operation()),a(x.v){}
+        typename UnaryProxy<V,Op>::result_type operator[](uint64_t k) const{ return this->operation()(a[k]); }
+    };
+}
 
 /**********************apply_op**********************************************/
+// the node an operation on (lhs, rhs) builds. operands<> has one partial
+// specialization per accepted pair, picked once: a Wrap is stripped, a
+// scalar wrapped, and a side with a shape makes the broadcasting
+// nd_binary. Any other pair has no operands<>, so the operator templates
+// drop out of overload resolution at their return type, without trying a
+// set of SFINAE'd candidates for every operator in every expression.
+namespace node_detail{
+    template<typename V1,typename V2,typename Op,bool nd = (nd_rank<V1>::value!=0||nd_rank<V2>::value!=0)>
+    struct pick{ using type = BinaryProxy<V1,V2,Op>; };
+    template<typename V1,typename V2,typename Op>
+    struct pick<V1,V2,Op,true>{ using type = nd_binary<V1,V2,Op>; };
+
+    template<typename V1,typename V2>
+    struct pair{
+        template<typename Op>
+        using node = Wrap<typename pick<V1,V2,Op>::type>;
+    };
+
+    template<typename T1,typename T2,typename = void>
+    struct operands{};
+    template<typename A,typename B>
+    struct operands<Wrap<A>,Wrap<B>,void>:pair<A,B>{
+        using value_type = ChooseType<typename A::value_type,typename B::value_type>;
+    };
+    template<typename A,typename S>
+    struct operands<Wrap<A>,S,typename std::enable_if<SRank<S>::value!=0>::type>:pair<A,ScalarWrapper<S>>{
+        using value_type = ChooseType<typename A::value_type,S>;
+    };
+    template<typename S,typename B>
+    struct operands<S,Wrap<B>,typename std::enable_if<SRank<S>::value!=0>::type>:pair<ScalarWrapper<S>,B>{
+        using value_type = ChooseType<S,typename B::value_type>;
+    };
 
+    template<typename T1,typename T2,typename Op>
+    using node = typename operands<T1,T2>::template node<Op>;
 
-template <typename Op, typename T1, typename T2>
-Wrap<BinaryProxy<T1,T2,Op>> apply_op(Wrap<T1> const& x, Wrap<T2> const& y, Op op = Op{}) {
-    T1 const& lhs{x};
-    T2 const& rhs{y};
-    BinaryProxy<T1, T2, Op> result{lhs,rhs,op};
-    return Wrap<BinaryProxy<T1, T2, Op>>{result};
+    // the node of an arithmetic functor F over the promoted type
+    template<typename T1,typename T2,template<typename> class F>
+    using arith = node<T1,T2,F<typename operands<T1,T2>::value_type>>;
 }
 
-template <typename Op, typename T1, typename T2>
-typename operation_enable_if<SRank<T2>::value!=0,Wrap<BinaryProxy<T1, ScalarWrapper<T2>, Op>>>::type apply_op(Wrap<T1> const& x, T2 const& y, Op op = Op{}) {
-    T1 const& lhs{x};
-    ScalarWrapper<T2> const& rhs{y};
-    BinaryProxy<T1, ScalarWrapper<T2>, Op> result{lhs,rhs,op};
-    return Wrap<BinaryProxy<T1, ScalarWrapper<T2>, Op>>{result};
+// the node is built in place in its Wrap through the inherited constructor;
+// a Wrap binds to its base and a scalar converts to its ScalarWrapper there
+template<typename Op,typename T1,typename T2>
+node_detail::node<T1,T2,Op> apply_op(const T1& x,const T2& y,Op op = Op{}){
+    return node_detail::node<T1,T2,Op>{x,y,op};
 }
 
-template <typename Op, typename T1, typename T2>
-typename operation_enable_if<SRank<T1>::value!=0,Wrap<BinaryProxy<ScalarWrapper<T1>, T2, Op>>>::type apply_op(T1 const& x, Wrap<T2> const& y, Op op = Op{}) {
-    ScalarWrapper<T1> const& lhs{x};
-    T2 const& rhs{y};
-    BinaryProxy<ScalarWrapper<T1>, T2, Op> result{lhs,rhs,op};
-    return Wrap<BinaryProxy<ScalarWrapper<T1>, T2, Op>>{result};
+/**********************making N-D views**********************************************/
+// view<2>(image,{rows,cols}) lays a row-major shape over the front of a
+// vector; as_row/as_column stand a 1-D vector up for broadcasting
+template<uint64_t D,typename T>
+Wrap<ndview<T,D>> view(vector<T>& v,const nd_shape<D>& shape){
+    return Wrap<ndview<T,D>>{ndview<T,D>{v,shape}};
+}
+template<uint64_t D,typename T>
+Wrap<ndview<const T,D>> view(const vector<T>& v,const nd_shape<D>& shape){
+    return Wrap<ndview<const T,D>>{ndview<const T,D>{v,shape}};
+}
+template<typename T>
+Wrap<ndview<const T,2>> as_row(const vector<T>& v){
+    return view<2>(v,nd_shape<2>{1,v.size()});
+}
+template<typename T>
+Wrap<ndview<const T,2>> as_column(const vector<T>& v){
+    return view<2>(v,nd_shape<2>{v.size(),1});
+}
+template<uint64_t D,typename T>
+Wrap<reshaped<T,D>> reshape(const Wrap<T>& x,const nd_shape<D>& shape){
+    return Wrap<reshaped<T,D>>{reshaped<T,D>{x,shape}};
 }
+
 /********************************* return type *********************************************************/
 template<typename T1,typename  T2>
 struct ReturnType{};
@@ -421,23 +1150,20 @@ struct ReturnType<Wrap<T1>,T2>{ using type = ChooseType<typename T1::value_type,
 /*********************************operator overload****************************************************/
 
 template<typename T1,typename T2>
-auto operator+(const T1&lhs,const T2&rhs)->decltype(apply_op(lhs,rhs,std::plus<typename ReturnType<T1,T2>::type>{})){
-    
-    return apply_op(lhs,rhs,std::plus<typename ReturnType<T1,T2>::type>{});
+node_detail::arith<T1,T2,std::plus> operator+(const T1& lhs,const T2& rhs){
+    return apply_op(lhs,rhs,std::plus<typename node_detail::operands<T1,T2>::value_type>{});
 }
 template<typename T1,typename T2>
-auto operator-(const T1&lhs,const T2& rhs)->decltype(apply_op(lhs,rhs,std::minus<typename ReturnType<T1,T2>::type>{})){
-    
-    return apply_op(lhs,rhs,std::minus<typename ReturnType<T1,T2>::type>{});
+node_detail::arith<T1,T2,std::minus> operator-(const T1& lhs,const T2& rhs){
+    return apply_op(lhs,rhs,std::minus<typename node_detail::operands<T1,T2>::value_type>{});
 }
 template<typename T1,typename T2>
-auto operator*(const T1& lhs,const T2& rhs)->decltype(apply_op(lhs,rhs,std::multiplies<typename ReturnType<T1,T2>::type>{})){
-    return apply_op(lhs,rhs,std::multiplies<typename ReturnType<T1,T2>::type>{});
+node_detail::arith<T1,T2,std::multiplies> operator*(const T1& lhs,const T2& rhs){
+    return apply_op(lhs,rhs,std::multiplies<typename node_detail::operands<T1,T2>::value_type>{});
 }
 template<typename T1,typename T2>
-auto operator/(const T1& lhs,const T2& rhs)->decltype(apply_op(lhs,rhs,std::divides<typename ReturnType<T1,T2>::type>{})){
-    
-    return apply_op(lhs,rhs,std::divides<typename ReturnType<T1,T2>::type>{});
+node_detail::arith<T1,T2,std::divides> operator/(const T1& lhs,const T2& rhs){
+    return apply_op(lhs,rhs,std::divides<typename node_detail::operands<T1,T2>::value_type>{});
 }
 
 template<typename T>
@@ -445,14 +1171,1198 @@ Wrap<UnaryProxy<T,std::negate< typename T::value_type>>> operator-(const Wrap<T>
     return Wrap<UnaryProxy<T, std::negate<typename T::value_type>>>{arg, std::negate<typename T::value_type>{}};
 }
 
-template<typename T>
-std::ostream& operator<<(std::ostream& out,const Wrap<T> t){
-    out<<"{ ";
-    for(uint64_t k = 0;k<t.size();++k){
-        out<<t[k]<<", ";
+/**********************dot and outer**********************************************/
+namespace dot_detail{
+    template<typename Acc,typename T1,typename T2>
+    Acc dot(const T1& x,const T2& y,uint64_t n,std::true_type /*both plain vectors*/){
+        if(n==0) return Acc(0);
+        const typename T1::value_type* p = &x[0];
+        const typename T2::value_type* q = &y[0];
+        return reduce_detail::sum<Acc>(n,[p,q](uint64_t k){ return static_cast<Acc>(p[k])*static_cast<Acc>(q[k]); });
     }
-    out<<" }";
-    return out;
+    template<typename Acc,typename T1,typename T2>
+    Acc dot(const T1& x,const T2& y,uint64_t n,std::false_type){
+        return reduce_detail::sum<Acc>(n,[&x,&y](uint64_t k){ return static_cast<Acc>(x[k])*static_cast<Acc>(y[k]); });
+    }
+
+    template<typename T>
+    using is_plain = std::is_base_of<vector<typename T::value_type>,T>;
+}
+
+// sum of x[k]*y[k] in Acc, by default the promoted element type;
+// dot<double>(x,y) for float data
+template<typename Acc = void,typename T1,typename T2>
+typename std::conditional<std::is_void<Acc>::value,ChooseType<typename T1::value_type,typename T2::value_type>,Acc>::type
+dot(const Wrap<T1>& x,const Wrap<T2>& y){
+    using R = typename std::conditional<std::is_void<Acc>::value,ChooseType<typename T1::value_type,typename T2::value_type>,Acc>::type;
+    if(x.size()!=y.size()){
+        throw std::invalid_argument("dot of different lengths");
+    }
+    return dot_detail::dot<R>(x,y,x.size(),
+        std::integral_constant<bool,dot_detail::is_plain<T1>::value&&dot_detail::is_plain<T2>::value>{});
+}
+
+// lazy x.size() by y.size() matrix of x[i]*y[j]
+template<typename T1,typename T2>
+auto outer(const Wrap<T1>& x,const Wrap<T2>& y)
+    ->decltype(apply_op(reshape<2>(x,nd_shape<2>{}),reshape<2>(y,nd_shape<2>{}),std::multiplies<typename ReturnType<Wrap<T1>,Wrap<T2>>::type>{})){
+    return apply_op(reshape<2>(x,nd_shape<2>{x.size(),1}),reshape<2>(y,nd_shape<2>{1,y.size()}),
+                    std::multiplies<typename ReturnType<Wrap<T1>,Wrap<T2>>::type>{});
+}
+
+/*********************************shift and stencil****************************************************/
+// BinaryProxy only ever pairs elements at the same index; these read the
+// operand at neighbouring indices instead
+
+// y[i] = x[i-k], positions that fall off either end read fill
+template<typename V>
+class ShiftProxy{
+public:
+    using Type = ChooseRef<V>;
+    Type v;
+    using value_type = typename V::value_type;
+    using result_type = value_type;
+
+private:
+    int64_t k;
+    value_type fill;
+
+public:
+    ShiftProxy(V const& src,int64_t by,value_type f):v(src),k(by),fill(f){}
+
+    uint64_t size() const{ return v.size(); }
+
+    value_type operator[](uint64_t i) const{
+        int64_t j = static_cast<int64_t>(i)-k;
+        if(j<0||j>=static_cast<int64_t>(v.size())) return fill;
+        return v[static_cast<uint64_t>(j)];
+    }
+
+    using const_iterator = MyIterator<ShiftProxy>;
+    const_iterator begin() const{ return const_iterator{*this,0}; }
+    const_iterator end() const{ return const_iterator{*this,size()}; }
+};
+
+// y[i] = w[0]*x[i] + ... + w[N-1]*x[i+N-1], only where the whole stencil
+// fits, so the result is N-1 shorter than x
+template<typename V,typename W,uint64_t N>
+class StencilProxy{
+public:
+    using Type = ChooseRef<V>;
+    Type v;
+    using value_type = ChooseType<typename V::value_type,W>;
+    using result_type = value_type;
+
+private:
+    std::array<W,N> w;
+
+public:
+    StencilProxy(V const& src,const std::array<W,N>& weights):v(src),w(weights){}
+
+    uint64_t size() const{
+        uint64_t n = v.size();
+        return n>=N ? n-N+1 : 0;
+    }
+
+    value_type operator[](uint64_t i) const{
+        value_type acc = value_type(0);
+        for(uint64_t j = 0;j<N;j++){
+            acc += static_cast<value_type>(w[j])*static_cast<value_type>(v[i+j]);
+        }
+        return acc;
+    }
+
+    using const_iterator = MyIterator<StencilProxy>;
+    const_iterator begin() const{ return const_iterator{*this,0}; }
+    const_iterator end() const{ return const_iterator{*this,size()}; }
+};
+
+template<typename V> struct static_extent<ShiftProxy<V>>:static_extent<V>{};
+template<typename V,typename W,uint64_t N>
+struct static_extent<StencilProxy<V,W,N>>{
+    static constexpr uint64_t e = static_extent<V>::value;
+    static constexpr uint64_t value = (e==0||e<N) ? 0 : e-N+1;
+};
+
+template<typename T>
+Wrap<ShiftProxy<T>> shift(const Wrap<T>& x,int64_t k,typename T::value_type fill = typename T::value_type(0)){
+    return Wrap<ShiftProxy<T>>{ShiftProxy<T>{x,k,fill}};
+}
+
+// stencil(x,{1.0,-2.0,1.0}) is a second difference
+template<typename T,typename W,uint64_t N>
+Wrap<StencilProxy<T,W,N>> stencil(const Wrap<T>& x,const W (&weights)[N]){
+    std::array<W,N> w;
+    std::copy(weights,weights+N,w.begin());
+    return Wrap<StencilProxy<T,W,N>>{StencilProxy<T,W,N>{x,w}};
+}
+template<typename T,typename W,uint64_t N>
+Wrap<StencilProxy<T,W,N>> stencil(const Wrap<T>& x,const std::array<W,N>& weights){
+    return Wrap<StencilProxy<T,W,N>>{StencilProxy<T,W,N>{x,weights}};
+}
+
+/*********************************n-ary apply****************************************************/
+// apply(op,a,b,c,...) is a single lazy node for a kernel of any arity, so
+// a three-input fma or lerp is one pass over its inputs rather than a
+// tree of binary nodes. Every input is converted to the type choose_type
+// promotes all of them to before op sees it, and op's result is
+// converted back to that type. Scalars may stand in for any input but
+// one; a unary op is x.apply(op)
+template<typename... Ts> struct choose_all;
+template<typename T> struct choose_all<T>{ using type = T; };
+template<typename T1,typename T2,typename... Ts>
+struct choose_all<T1,T2,Ts...>:choose_all<ChooseType<T1,T2>,Ts...>{};
+
+namespace nary_detail{
+    template<typename X> struct is_wrap:std::false_type{};
+    template<typename T> struct is_wrap<Wrap<T>>:std::true_type{};
+
+    // what a node stores for an argument
+    template<typename X>
+    struct operand{
+        using type = ScalarWrapper<X>;
+        static type make(const X& x){ return type{x}; }
+    };
+    template<typename T>
+    struct operand<Wrap<T>>{
+        using type = T;
+        static const T& make(const Wrap<T>& x){ return x; }
+    };
+
+    template<typename... Xs>
+    struct valid:std::integral_constant<bool,(sizeof...(Xs)>=2)&&
+                                             ((is_wrap<Xs>::value||SRank<Xs>::value!=0)&&...)&&
+                                             (is_wrap<Xs>::value||...)>{};
+
+    // the smallest static extent, 0 if any input only knows its size at run time
+    constexpr uint64_t min_extent(void){ return any_extent; }
+    template<typename... E>
+    constexpr uint64_t min_extent(uint64_t e,E... rest){
+        uint64_t r = min_extent(rest...);
+        return (e==0||r==0) ? 0 : (e<r ? e : r);
+    }
+
+    // element access for evaluate_into: plain vectors through their
+    // buffer, scalars hoisted out of the loop
+    template<typename V,typename R>
+    struct reader{
+        const V& v;
+        explicit reader(const V& x):v(x){}
+        R operator[](uint64_t k) const{ return static_cast<R>(v[k]); }
+    };
+    template<typename T,typename R>
+    struct reader<vector<T>,R>{
+        const T* p;
+        explicit reader(const vector<T>& x):p(x.size()==0 ? nullptr : &x[0]){}
+        R operator[](uint64_t k) const{ return static_cast<R>(p[k]); }
+    };
+    template<typename T,typename R>
+    struct reader<ScalarWrapper<T>,R>{
+        R c;
+        explicit reader(const ScalarWrapper<T>& x):c(static_cast<R>(x[0])){}
+        R operator[](uint64_t) const{ return c; }
+    };
+}
+
+template<typename Op,typename... Vs>
+class NaryProxy{
+public:
+    std::tuple<ChooseRef<Vs>...> xs;
+    Op op;
+    using value_type = typename choose_all<typename Vs::value_type...>::type;
+    using result_type = value_type;
+
+    NaryProxy(Op operation,const Vs&... inputs):xs(inputs...),op(operation){}
+
+    uint64_t size() const{
+        constexpr uint64_t extent = nary_detail::min_extent(static_extent<Vs>::value...);
+        return extent!=0 ? extent : sizes(std::index_sequence_for<Vs...>{});
+    }
+
+    value_type operator[](uint64_t k) const{
+        return at(k,std::index_sequence_for<Vs...>{});
+    }
+
+    // one loop over all inputs straight into a plain vector's buffer
+    template<typename T>
+    void evaluate_into(T* out,uint64_t n) const{
+        fill(out,n,std::index_sequence_for<Vs...>{});
+    }
+
+    using const_iterator = MyIterator<NaryProxy>;
+    const_iterator begin() const{ return const_iterator{*this,0}; }
+    const_iterator end() const{ return const_iterator{*this,size()}; }
+
+private:
+    template<std::size_t... I>
+    value_type at(uint64_t k,std::index_sequence<I...>) const{
+        return static_cast<value_type>(op(static_cast<value_type>(std::get<I>(xs)[k])...));
+    }
+    template<std::size_t... I>
+    uint64_t sizes(std::index_sequence<I...>) const{
+        uint64_t n = std::numeric_limits<uint64_t>::max();
+        ((n = std::min<uint64_t>(n,std::get<I>(xs).size())),...);
+        return n;
+    }
+    template<typename T,std::size_t... I>
+    void fill(T* out,uint64_t n,std::index_sequence<I...>) const{
+        run(out,n,nary_detail::reader<Vs,value_type>(std::get<I>(xs))...);
+    }
+    template<typename T,typename... Rs>
+    void run(T* out,uint64_t n,const Rs&... in) const{
+        for(uint64_t k = 0;k<n;k++){
+            out[k] = static_cast<T>(static_cast<value_type>(op(in[k]...)));
+        }
+    }
+};
+
+template<typename Op,typename... Vs>
+struct static_extent<NaryProxy<Op,Vs...>>:std::integral_constant<uint64_t,nary_detail::min_extent(static_extent<Vs>::value...)>{};
+
+// apply([](double a,double b,double c){ return a*b+c; },x,y,z)
+template<typename Op,typename... Xs>
+typename operation_enable_if<nary_detail::valid<Xs...>::value,Wrap<NaryProxy<Op,typename nary_detail::operand<Xs>::type...>>>::type
+apply(Op op,const Xs&... xs){
+    using node = NaryProxy<Op,typename nary_detail::operand<Xs>::type...>;
+    static_assert(((nd_rank<typename nary_detail::operand<Xs>::type>::value==0)&&...),"apply() takes 1-D operands");
+    return Wrap<node>{node{op,nary_detail::operand<Xs>::make(xs)...}};
+}
+
+/*********************************saturating arithmetic****************************************************/
+// integers clamp to the range of T instead of wrapping around, anything else
+// is plain arithmetic; narrow integers go through int64_t without branches
+namespace saturate_detail{
+    template<typename T>
+    using kind = std::integral_constant<int,!std::is_integral<T>::value ? 0 : (sizeof(T)<sizeof(int64_t) ? 1 : 2)>;
+
+    template<typename T>
+    T clamp(int64_t v){
+        v = std::max<int64_t>(v,static_cast<int64_t>(std::numeric_limits<T>::min()));
+        v = std::min<int64_t>(v,static_cast<int64_t>(std::numeric_limits<T>::max()));
+        return static_cast<T>(v);
+    }
+
+    template<typename T> T add(T a,T b,std::integral_constant<int,0>){ return a+b; }
+    template<typename T> T sub(T a,T b,std::integral_constant<int,0>){ return a-b; }
+    template<typename T> T add(T a,T b,std::integral_constant<int,1>){ return clamp<T>(int64_t(a)+int64_t(b)); }
+    template<typename T> T sub(T a,T b,std::integral_constant<int,1>){ return clamp<T>(int64_t(a)-int64_t(b)); }
+
+    template<typename T> T add(T a,T b,std::integral_constant<int,2>){
+        T r;
+        if(__builtin_add_overflow(a,b,&r)){
+            return (std::is_signed<T>::value&&b<T(0)) ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+        }
+        return r;
+    }
+    template<typename T> T sub(T a,T b,std::integral_constant<int,2>){
+        T r;
+        if(__builtin_sub_overflow(a,b,&r)){
+            return (std::is_signed<T>::value&&b<T(0)) ? std::numeric_limits<T>::max() : std::numeric_limits<T>::min();
+        }
+        return r;
+    }
+
+    // 8 and 16 bit integers have saturating SSE2 instructions, 16 bytes a step
+    template<typename T> struct packed:std::false_type{};
+#ifdef __SSE2__
+    template<> struct packed<int8_t>:std::true_type{};
+    template<> struct packed<uint8_t>:std::true_type{};
+    template<> struct packed<int16_t>:std::true_type{};
+    template<> struct packed<uint16_t>:std::true_type{};
+
+    inline __m128i add(__m128i x,__m128i y,int8_t*){ return _mm_adds_epi8(x,y); }
+    inline __m128i add(__m128i x,__m128i y,uint8_t*){ return _mm_adds_epu8(x,y); }
+    inline __m128i add(__m128i x,__m128i y,int16_t*){ return _mm_adds_epi16(x,y); }
+    inline __m128i add(__m128i x,__m128i y,uint16_t*){ return _mm_adds_epu16(x,y); }
+    inline __m128i sub(__m128i x,__m128i y,int8_t*){ return _mm_subs_epi8(x,y); }
+    inline __m128i sub(__m128i x,__m128i y,uint8_t*){ return _mm_subs_epu8(x,y); }
+    inline __m128i sub(__m128i x,__m128i y,int16_t*){ return _mm_subs_epi16(x,y); }
+    inline __m128i sub(__m128i x,__m128i y,uint16_t*){ return _mm_subs_epu16(x,y); }
+
+    // returns how many leading elements were done
+    template<typename T,bool subtract>
+    uint64_t packed_loop(T* out,const T* a,const T* b,uint64_t n,std::true_type){
+        constexpr uint64_t lanes = sizeof(__m128i)/sizeof(T);
+        uint64_t k = 0;
+        for(;k+lanes<=n;k += lanes){
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a+k));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+k));
+            __m128i r = subtract ? sub(x,y,static_cast<T*>(nullptr)) : add(x,y,static_cast<T*>(nullptr));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out+k),r);
+        }
+        return k;
+    }
+#endif
+    template<typename T,bool subtract>
+    uint64_t packed_loop(T*,const T*,const T*,uint64_t,std::false_type){ return 0; }
+
+    template<typename T,bool subtract>
+    void kernel(vector<T>& out,const vector<T>& a,const vector<T>& b){
+        uint64_t n = std::min(a.size(),b.size());
+        if(out.size()<n){
+            throw std::out_of_range("saturating destination is too short");
+        }
+        if(n==0) return;
+        T* dst = &out[0];
+        const T* x = &a[0];
+        const T* y = &b[0];
+        uint64_t k = packed_loop<T,subtract>(dst,x,y,n,packed<T>{});
+        for(;k<n;k++){
+            dst[k] = subtract ? sub(x[k],y[k],kind<T>{}) : add(x[k],y[k],kind<T>{});
+        }
+    }
+}
+
+template<typename T>
+struct sat_plus{
+    using result_type = T;
+    T operator()(T a,T b)const{ return saturate_detail::add(a,b,saturate_detail::kind<T>{}); }
+};
+template<typename T>
+struct sat_minus{
+    using result_type = T;
+    T operator()(T a,T b)const{ return saturate_detail::sub(a,b,saturate_detail::kind<T>{}); }
+};
+
+// saturation happens in the element type, never the widened one; a scalar
+// operand takes the type of the array it is combined with
+template<typename T1,typename T2>
+struct SatType{};
+template<typename T1,typename T2>
+struct SatType<Wrap<T1>,Wrap<T2>>{ using type = typename choose_type<typename T1::value_type,typename T2::value_type,false>::type;};
+template<typename T1,typename T2>
+struct SatType<T1,Wrap<T2>>{ using type = typename T2::value_type;};
+template<typename T1,typename T2>
+struct SatType<Wrap<T1>,T2>{ using type = typename T1::value_type;};
+
+template<typename T1,typename T2>
+auto add_sat(const T1& lhs,const T2& rhs)->decltype(apply_op(lhs,rhs,sat_plus<typename SatType<T1,T2>::type>{})){
+    return apply_op(lhs,rhs,sat_plus<typename SatType<T1,T2>::type>{});
+}
+template<typename T1,typename T2>
+auto sub_sat(const T1& lhs,const T2& rhs)->decltype(apply_op(lhs,rhs,sat_minus<typename SatType<T1,T2>::type>{})){
+    return apply_op(lhs,rhs,sat_minus<typename SatType<T1,T2>::type>{});
+}
+
+// eager forms over whole arrays, packed when the element type allows it;
+// out must already hold min(a.size(), b.size()) elements
+template<typename T>
+void add_sat(vector<T>& out,const vector<T>& a,const vector<T>& b){
+    saturate_detail::kernel<T,false>(out,a,b);
+}
+template<typename T>
+void sub_sat(vector<T>& out,const vector<T>& a,const vector<T>& b){
+    saturate_detail::kernel<T,true>(out,a,b);
+}
+
+/*********************************packed arithmetic****************************************************/
+namespace simd_detail{
+    // a pack is one register of T; scalar_pack runs the tail
+    template<typename T>
+    struct scalar_pack{
+        using reg = T;
+        static constexpr uint64_t width = 1;
+        static reg load(const T* p){ return *p; }
+        static void store(T* p,reg v){ *p = v; }
+        static reg zero(void){ return T(0); }
+        static reg set1(T a){ return a; }
+        static reg add(reg a,reg b){ return a+b; }
+        static reg sub(reg a,reg b){ return a-b; }
+        static reg mul(reg a,reg b){ return a*b; }
+        static reg div(reg a,reg b){ return a/b; }
+        static reg sqrt(reg a){ using std::sqrt; return sqrt(a); }
+        static reg min(reg a,reg b){ return b<a ? b : a; }
+        static reg max(reg a,reg b){ return a<b ? b : a; }
+    };
+    template<typename T> struct simd_pack:scalar_pack<T>{};
+#ifdef __SSE2__
+    template<> struct simd_pack<double>{
+        using reg = __m128d;
+        static constexpr uint64_t width = 2;
+        static reg load(const double* p){ return _mm_loadu_pd(p); }
+        static void store(double* p,reg v){ _mm_storeu_pd(p,v); }
+        static reg zero(void){ return _mm_setzero_pd(); }
+        static reg set1(double a){ return _mm_set1_pd(a); }
+        static reg add(reg a,reg b){ return _mm_add_pd(a,b); }
+        static reg sub(reg a,reg b){ return _mm_sub_pd(a,b); }
+        static reg mul(reg a,reg b){ return _mm_mul_pd(a,b); }
+        static reg div(reg a,reg b){ return _mm_div_pd(a,b); }
+        static reg sqrt(reg a){ return _mm_sqrt_pd(a); }
+        static reg min(reg a,reg b){ return _mm_min_pd(b,a); }
+        static reg max(reg a,reg b){ return _mm_max_pd(b,a); }
+    };
+    template<> struct simd_pack<float>{
+        using reg = __m128;
+        static constexpr uint64_t width = 4;
+        static reg load(const float* p){ return _mm_loadu_ps(p); }
+        static void store(float* p,reg v){ _mm_storeu_ps(p,v); }
+        static reg zero(void){ return _mm_setzero_ps(); }
+        static reg set1(float a){ return _mm_set1_ps(a); }
+        static reg add(reg a,reg b){ return _mm_add_ps(a,b); }
+        static reg sub(reg a,reg b){ return _mm_sub_ps(a,b); }
+        static reg mul(reg a,reg b){ return _mm_mul_ps(a,b); }
+        static reg div(reg a,reg b){ return _mm_div_ps(a,b); }
+        static reg sqrt(reg a){ return _mm_sqrt_ps(a); }
+        static reg min(reg a,reg b){ return _mm_min_ps(b,a); }
+        static reg max(reg a,reg b){ return _mm_max_ps(b,a); }
+    };
+#endif
+}
+
+/*********************************masks and where****************************************************/
+// x<y and friends are lazy bool masks (elementwise, broadcasting like any
+// other binary op); where(mask,a,b) picks a[k] where mask[k] is set and
+// b[k] elsewhere. Both sides are read for every k, so the choice is a
+// select rather than a branch. Assigned to a plain float or double
+// vector, where(x<y,a,b) over plain vectors and scalars of that type
+// runs packed: one compare and one blend per register.
+template<typename T,typename Cmp>
+struct compare_op{
+    using result_type = bool;
+    bool operator()(const T& a,const T& b) const{ return Cmp{}(a,b); }
+};
+struct mask_and{
+    using result_type = bool;
+    bool operator()(bool a,bool b) const{ return a&&b; }
+};
+struct mask_or{
+    using result_type = bool;
+    bool operator()(bool a,bool b) const{ return a||b; }
+};
+
+namespace node_detail{
+    // the bool mask of comparing with Cmp in the promoted type
+    template<typename T1,typename T2,template<typename> class Cmp>
+    using mask = node<T1,T2,compare_op<typename operands<T1,T2>::value_type,Cmp<typename operands<T1,T2>::value_type>>>;
+}
+
+template<typename T1,typename T2>
+node_detail::mask<T1,T2,std::less> operator<(const T1& lhs,const T2& rhs){
+    using R = typename node_detail::operands<T1,T2>::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::less<R>>{});
+}
+template<typename T1,typename T2>
+node_detail::mask<T1,T2,std::less_equal> operator<=(const T1& lhs,const T2& rhs){
+    using R = typename node_detail::operands<T1,T2>::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::less_equal<R>>{});
+}
+template<typename T1,typename T2>
+node_detail::mask<T1,T2,std::greater> operator>(const T1& lhs,const T2& rhs){
+    using R = typename node_detail::operands<T1,T2>::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::greater<R>>{});
+}
+template<typename T1,typename T2>
+node_detail::mask<T1,T2,std::greater_equal> operator>=(const T1& lhs,const T2& rhs){
+    using R = typename node_detail::operands<T1,T2>::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::greater_equal<R>>{});
+}
+template<typename T1,typename T2>
+node_detail::mask<T1,T2,std::equal_to> operator==(const T1& lhs,const T2& rhs){
+    using R = typename node_detail::operands<T1,T2>::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::equal_to<R>>{});
+}
+template<typename T1,typename T2>
+node_detail::mask<T1,T2,std::not_equal_to> operator!=(const T1& lhs,const T2& rhs){
+    using R = typename node_detail::operands<T1,T2>::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::not_equal_to<R>>{});
+}
+// Vector.h pulls in std::rel_ops, whose operator>(const T&,const T&) would
+// win over the pairs above when both sides have the same type
+template<typename T>
+node_detail::mask<Wrap<T>,Wrap<T>,std::less_equal> operator<=(const Wrap<T>& lhs,const Wrap<T>& rhs){
+    using R = typename T::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::less_equal<R>>{});
+}
+template<typename T>
+node_detail::mask<Wrap<T>,Wrap<T>,std::greater> operator>(const Wrap<T>& lhs,const Wrap<T>& rhs){
+    using R = typename T::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::greater<R>>{});
+}
+template<typename T>
+node_detail::mask<Wrap<T>,Wrap<T>,std::greater_equal> operator>=(const Wrap<T>& lhs,const Wrap<T>& rhs){
+    using R = typename T::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::greater_equal<R>>{});
+}
+template<typename T>
+node_detail::mask<Wrap<T>,Wrap<T>,std::not_equal_to> operator!=(const Wrap<T>& lhs,const Wrap<T>& rhs){
+    using R = typename T::value_type;
+    return apply_op(lhs,rhs,compare_op<R,std::not_equal_to<R>>{});
+}
+template<typename T1,typename T2>
+node_detail::node<Wrap<T1>,Wrap<T2>,mask_and> operator&&(const Wrap<T1>& lhs,const Wrap<T2>& rhs){
+    return apply_op(lhs,rhs,mask_and{});
+}
+template<typename T1,typename T2>
+node_detail::node<Wrap<T1>,Wrap<T2>,mask_or> operator||(const Wrap<T1>& lhs,const Wrap<T2>& rhs){
+    return apply_op(lhs,rhs,mask_or{});
+}
+
+namespace select_detail{
+    // how a where() operand is read a register at a time; only plain
+    // vectors and scalars of the packed type can be
+    template<typename V,typename R>
+    struct lanes:std::false_type{};
+
+    template<typename M,typename R>
+    struct mask_lanes:std::false_type{};
+
+#ifdef __SSE2__
+    template<typename R> struct ops;
+    template<> struct ops<float>{
+        using reg = __m128;
+        static reg lt(reg a,reg b){ return _mm_cmplt_ps(a,b); }
+        static reg le(reg a,reg b){ return _mm_cmple_ps(a,b); }
+        static reg gt(reg a,reg b){ return _mm_cmpgt_ps(a,b); }
+        static reg ge(reg a,reg b){ return _mm_cmpge_ps(a,b); }
+        static reg eq(reg a,reg b){ return _mm_cmpeq_ps(a,b); }
+        static reg ne(reg a,reg b){ return _mm_cmpneq_ps(a,b); }
+        // m ? a : b lane by lane
+        static reg blend(reg m,reg a,reg b){
+#ifdef __SSE4_1__
+            return _mm_blendv_ps(b,a,m);
+#else
+            return _mm_or_ps(_mm_and_ps(m,a),_mm_andnot_ps(m,b));
+#endif
+        }
+    };
+    template<> struct ops<double>{
+        using reg = __m128d;
+        static reg lt(reg a,reg b){ return _mm_cmplt_pd(a,b); }
+        static reg le(reg a,reg b){ return _mm_cmple_pd(a,b); }
+        static reg gt(reg a,reg b){ return _mm_cmpgt_pd(a,b); }
+        static reg ge(reg a,reg b){ return _mm_cmpge_pd(a,b); }
+        static reg eq(reg a,reg b){ return _mm_cmpeq_pd(a,b); }
+        static reg ne(reg a,reg b){ return _mm_cmpneq_pd(a,b); }
+        static reg blend(reg m,reg a,reg b){
+#ifdef __SSE4_1__
+            return _mm_blendv_pd(b,a,m);
+#else
+            return _mm_or_pd(_mm_and_pd(m,a),_mm_andnot_pd(m,b));
+#endif
+        }
+    };
+
+    template<typename Cmp> struct predicate;
+    template<typename R> struct predicate<std::less<R>>{
+        template<typename P> static typename P::reg apply(typename P::reg a,typename P::reg b){ return P::lt(a,b); }
+    };
+    template<typename R> struct predicate<std::less_equal<R>>{
+        template<typename P> static typename P::reg apply(typename P::reg a,typename P::reg b){ return P::le(a,b); }
+    };
+    template<typename R> struct predicate<std::greater<R>>{
+        template<typename P> static typename P::reg apply(typename P::reg a,typename P::reg b){ return P::gt(a,b); }
+    };
+    template<typename R> struct predicate<std::greater_equal<R>>{
+        template<typename P> static typename P::reg apply(typename P::reg a,typename P::reg b){ return P::ge(a,b); }
+    };
+    template<typename R> struct predicate<std::equal_to<R>>{
+        template<typename P> static typename P::reg apply(typename P::reg a,typename P::reg b){ return P::eq(a,b); }
+    };
+    template<typename R> struct predicate<std::not_equal_to<R>>{
+        template<typename P> static typename P::reg apply(typename P::reg a,typename P::reg b){ return P::ne(a,b); }
+    };
+
+    template<typename R>
+    struct lanes<vector<R>,R>:std::true_type{
+        const R* p;
+        explicit lanes(const vector<R>& v):p(&v[0]){}
+        typename simd_detail::simd_pack<R>::reg get(uint64_t k) const{ return simd_detail::simd_pack<R>::load(p+k); }
+    };
+    template<typename R>
+    struct lanes<ScalarWrapper<R>,R>:std::true_type{
+        typename simd_detail::simd_pack<R>::reg r;
+        explicit lanes(const ScalarWrapper<R>& s):r(simd_detail::simd_pack<R>::set1(s[0])){}
+        typename simd_detail::simd_pack<R>::reg get(uint64_t) const{ return r; }
+    };
+
+    template<typename X,typename Y,typename R,typename Cmp>
+    struct mask_lanes<BinaryProxy<X,Y,compare_op<R,Cmp>>,R>
+        :std::integral_constant<bool,lanes<X,R>::value&&lanes<Y,R>::value>{
+        using left = lanes<X,R>;
+        using right = lanes<Y,R>;
+        using test = predicate<Cmp>;
+    };
+
+    template<typename R>
+    struct packable:std::integral_constant<bool,std::is_same<R,float>::value||std::is_same<R,double>::value>{};
+#else
+    template<typename R>
+    struct packable:std::false_type{};
+#endif
+}
+
+template<typename M,typename A,typename B>
+class SelectProxy{
+public:
+    using MaskType = ChooseRef<M>;
+    using LeftType = ChooseRef<A>;
+    using RightType = ChooseRef<B>;
+    MaskType m;
+    LeftType a;
+    RightType b;
+    using value_type = ChooseType<typename A::value_type,typename B::value_type>;
+    using result_type = value_type;
+
+    SelectProxy(M const& mask,A const& x,B const& y):m(mask),a(x),b(y){}
+
+    uint64_t size() const{
+        return std::min(m.size(),std::min<uint64_t>(a.size(),b.size()));
+    }
+
+    value_type operator[](uint64_t k) const{
+        // indexing by the mask bit instead of ?: keeps the compiler from
+        // turning the select back into a jump
+        const value_type pick[2] = {static_cast<value_type>(b[k]),static_cast<value_type>(a[k])};
+        return pick[static_cast<bool>(m[k])];
+    }
+
+    // straight into a plain vector's buffer, packed where the operands allow
+    template<typename T>
+    void evaluate_into(T* out,uint64_t n) const{
+        using R = value_type;
+        evaluate_into(out,n,std::integral_constant<bool,std::is_same<T,R>::value&&select_detail::packable<R>::value&&
+                                                        select_detail::mask_lanes<M,R>::value&&
+                                                        select_detail::lanes<A,R>::value&&select_detail::lanes<B,R>::value>{});
+    }
+
+    using const_iterator = MyIterator<SelectProxy>;
+    const_iterator begin() const{ return const_iterator{*this,0}; }
+    const_iterator end() const{ return const_iterator{*this,size()}; }
+
+private:
+    template<typename T>
+    void evaluate_into(T* out,uint64_t n,std::false_type) const{
+        for(uint64_t k = 0;k<n;k++){
+            out[k] = static_cast<T>((*this)[k]);
+        }
+    }
+#ifdef __SSE2__
+    template<typename T>
+    void evaluate_into(T* out,uint64_t n,std::true_type) const{
+        using P = simd_detail::simd_pack<T>;
+        using O = select_detail::ops<T>;
+        using L = select_detail::mask_lanes<M,T>;
+        constexpr uint64_t W = P::width;
+        typename L::left x(m.v1);
+        typename L::right y(m.v2);
+        select_detail::lanes<A,T> u(a);
+        select_detail::lanes<B,T> v(b);
+        uint64_t k = 0;
+        for(;k+W<=n;k += W){
+            P::store(out+k,O::blend(L::test::template apply<O>(x.get(k),y.get(k)),u.get(k),v.get(k)));
+        }
+        for(;k<n;k++){
+            out[k] = (*this)[k];
+        }
+    }
+#endif
+};
+
+template<typename M,typename A,typename B>
+struct static_extent<SelectProxy<M,A,B>>{
+    static constexpr uint64_t em = static_extent<M>::value,ea = static_extent<A>::value,eb = static_extent<B>::value;
+    static constexpr uint64_t eab = ea==0||eb==0 ? 0 : (ea<eb ? ea : eb);
+    static constexpr uint64_t value = em==0||eab==0 ? 0 : (em<eab ? em : eab);
+};
+
+// where(x<lo,lo,x) clamps from below; a and b may be scalars
+template<typename M,typename A,typename B>
+Wrap<SelectProxy<M,A,B>> where(const Wrap<M>& mask,const Wrap<A>& a,const Wrap<B>& b){
+    static_assert(nd_rank<M>::value==0&&nd_rank<A>::value==0&&nd_rank<B>::value==0,"where() takes 1-D operands");
+    return Wrap<SelectProxy<M,A,B>>{SelectProxy<M,A,B>{mask,a,b}};
+}
+template<typename M,typename A,typename B>
+typename operation_enable_if<SRank<B>::value!=0,Wrap<SelectProxy<M,A,ScalarWrapper<B>>>>::type
+where(const Wrap<M>& mask,const Wrap<A>& a,const B& b){
+    return where(mask,a,Wrap<ScalarWrapper<B>>{ScalarWrapper<B>{b}});
+}
+template<typename M,typename A,typename B>
+typename operation_enable_if<SRank<A>::value!=0,Wrap<SelectProxy<M,ScalarWrapper<A>,B>>>::type
+where(const Wrap<M>& mask,const A& a,const Wrap<B>& b){
+    return where(mask,Wrap<ScalarWrapper<A>>{ScalarWrapper<A>{a}},b);
+}
+template<typename M,typename A,typename B>
+typename operation_enable_if<SRank<A>::value!=0&&SRank<B>::value!=0,Wrap<SelectProxy<M,ScalarWrapper<A>,ScalarWrapper<B>>>>::type
+where(const Wrap<M>& mask,const A& a,const B& b){
+    return where(mask,Wrap<ScalarWrapper<A>>{ScalarWrapper<A>{a}},Wrap<ScalarWrapper<B>>{ScalarWrapper<B>{b}});
+}
+
+/*********************************split complex****************************************************/
+// valarray<complex<T>> stores re,im interleaved and multiplies through
+// std::multiplies<complex<T>>, which checks every product for NaN/inf.
+// split_complex keeps the real and the imaginary parts in two epl::vectors
+// and uses the plain formulas instead, so whole-array kernels run packed.
+// Its value_type is still complex<T>: is_complex/CType promotion and mixing
+// with valarray<complex<T>> or real scalars work as before.
+template<typename T>
+class split_complex;
+
+// no NaN/inf recovery and no scaling in the division, like -ffast-math
+template<typename C>
+struct fast_multiplies{
+    using result_type = C;
+    C operator()(const C& a,const C& b)const{
+        return C{a.real()*b.real()-a.imag()*b.imag(),a.real()*b.imag()+a.imag()*b.real()};
+    }
+};
+template<typename C>
+struct fast_divides{
+    using result_type = C;
+    C operator()(const C& a,const C& b)const{
+        auto d = b.real()*b.real()+b.imag()*b.imag();
+        return C{(a.real()*b.real()+a.imag()*b.imag())/d,(a.imag()*b.real()-a.real()*b.imag())/d};
+    }
+};
+template<typename C>
+struct fast_conj{
+    using result_type = C;
+    C operator()(const C& a)const{ return C{a.real(),-a.imag()}; }
+};
+
+namespace split_detail{
+    using simd_detail::scalar_pack;
+    using simd_detail::simd_pack;
+
+    template<typename T>
+    struct spans{
+        T* ore;
+        T* oim;
+        const T* ar;
+        const T* ai;
+        const T* br;
+        const T* bi;
+    };
+
+    // every step loads its inputs before storing, so out may alias a or b
+    struct add_step{
+        template<typename P,typename T> static void step(spans<T> const& s,uint64_t k){
+            auto xr = P::load(s.ar+k),xi = P::load(s.ai+k),yr = P::load(s.br+k),yi = P::load(s.bi+k);
+            P::store(s.ore+k,P::add(xr,yr));
+            P::store(s.oim+k,P::add(xi,yi));
+        }
+    };
+    struct sub_step{
+        template<typename P,typename T> static void step(spans<T> const& s,uint64_t k){
+            auto xr = P::load(s.ar+k),xi = P::load(s.ai+k),yr = P::load(s.br+k),yi = P::load(s.bi+k);
+            P::store(s.ore+k,P::sub(xr,yr));
+            P::store(s.oim+k,P::sub(xi,yi));
+        }
+    };
+    struct mul_step{
+        template<typename P,typename T> static void step(spans<T> const& s,uint64_t k){
+            auto xr = P::load(s.ar+k),xi = P::load(s.ai+k),yr = P::load(s.br+k),yi = P::load(s.bi+k);
+            P::store(s.ore+k,P::sub(P::mul(xr,yr),P::mul(xi,yi)));
+            P::store(s.oim+k,P::add(P::mul(xr,yi),P::mul(xi,yr)));
+        }
+    };
+    struct div_step{
+        template<typename P,typename T> static void step(spans<T> const& s,uint64_t k){
+            auto xr = P::load(s.ar+k),xi = P::load(s.ai+k),yr = P::load(s.br+k),yi = P::load(s.bi+k);
+            auto d = P::add(P::mul(yr,yr),P::mul(yi,yi));
+            P::store(s.ore+k,P::div(P::add(P::mul(xr,yr),P::mul(xi,yi)),d));
+            P::store(s.oim+k,P::div(P::sub(P::mul(xi,yr),P::mul(xr,yi)),d));
+        }
+    };
+    struct conj_step{
+        template<typename P,typename T> static void step(spans<T> const& s,uint64_t k){
+            auto xr = P::load(s.ar+k),xi = P::load(s.ai+k);
+            P::store(s.ore+k,xr);
+            P::store(s.oim+k,P::sub(P::zero(),xi));
+        }
+    };
+    // |z| into ore only, without hypot's overflow guard
+    struct abs_step{
+        template<typename P,typename T> static void step(spans<T> const& s,uint64_t k){
+            auto xr = P::load(s.ar+k),xi = P::load(s.ai+k);
+            P::store(s.ore+k,P::sqrt(P::add(P::mul(xr,xr),P::mul(xi,xi))));
+        }
+    };
+
+    template<typename Step,typename T>
+    void run(spans<T> const& s,uint64_t n){
+        using P = simd_pack<T>;
+        uint64_t k = 0;
+        for(;k+P::width<=n;k += P::width){
+            Step::template step<P>(s,k);
+        }
+        for(;k<n;k++){
+            Step::template step<scalar_pack<T>>(s,k);
+        }
+    }
+
+    template<typename Step,typename T>
+    void binary(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b){
+        uint64_t n = std::min(a.size(),b.size());
+        if(out.size()<n){
+            throw std::out_of_range("split complex destination is too short");
+        }
+        if(n==0) return;
+        run<Step>(spans<T>{&out.re[0],&out.im[0],&a.re[0],&a.im[0],&b.re[0],&b.im[0]},n);
+    }
+
+    // the ops split_complex has packed kernels for, anything else goes element by element
+    template<typename T,typename Op>
+    void binary(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b,Op op){
+        uint64_t n = std::min(a.size(),b.size());
+        for(uint64_t k = 0;k<n;k++){
+            complex<T> z = op(a[k],b[k]);
+            out.re[k] = z.real();
+            out.im[k] = z.imag();
+        }
+    }
+    template<typename T>
+    void binary(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b,std::plus<complex<T>>){
+        binary<add_step>(out,a,b);
+    }
+    template<typename T>
+    void binary(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b,std::minus<complex<T>>){
+        binary<sub_step>(out,a,b);
+    }
+    template<typename T>
+    void binary(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b,fast_multiplies<complex<T>>){
+        binary<mul_step>(out,a,b);
+    }
+    template<typename T>
+    void binary(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b,fast_divides<complex<T>>){
+        binary<div_step>(out,a,b);
+    }
+}
+
+template<typename T>
+class split_complex{
+public:
+    vector<T> re;
+    vector<T> im;
+    using value_type = complex<T>;
+
+    // what (*this)[k] = z goes through in Wrap's assignments
+    class reference{
+        split_complex& parent;
+        uint64_t index;
+    public:
+        reference(split_complex& p,uint64_t k):parent(p),index(k){}
+        reference& operator=(const complex<T>& z){
+            parent.re[index] = z.real();
+            parent.im[index] = z.imag();
+            return *this;
+        }
+        reference& operator=(const reference& that){
+            return *this = static_cast<complex<T>>(that);
+        }
+        operator complex<T>()const{
+            return complex<T>{parent.re[index],parent.im[index]};
+        }
+        friend bool operator==(const reference& lhs,const complex<T>& rhs){ return complex<T>(lhs)==rhs; }
+        friend bool operator!=(const reference& lhs,const complex<T>& rhs){ return complex<T>(lhs)!=rhs; }
+    };
+
+    class const_iterator{
+        const split_complex* parent;
+        uint64_t index;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = complex<T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const complex<T>*;
+        using reference = complex<T>;
+
+        const_iterator(const split_complex* p,uint64_t k):parent(p),index(k){}
+        complex<T> operator*(void)const{ return (*parent)[index]; }
+        const_iterator& operator++(void){ index++; return *this; }
+        const_iterator operator++(int){ const_iterator t{*this}; index++; return t; }
+        bool operator==(const const_iterator& rhs)const{ return index==rhs.index; }
+        bool operator!=(const const_iterator& rhs)const{ return index!=rhs.index; }
+    };
+
+    split_complex(void){}
+    explicit split_complex(uint64_t n):re(n),im(n){}
+    split_complex(std::initializer_list<complex<T>> list){
+        for(auto const& z:list){
+            push_back(z);
+        }
+    }
+
+    // c = a op b for two split leaves is done by the packed kernels
+    template<typename Op>
+    split_complex(const Wrap<BinaryProxy<split_complex,split_complex,Op>>& that):re(that.size()),im(that.size()){
+        split_detail::binary(*this,that.v1,that.v2,that.operation());
+    }
+
+    uint64_t size(void)const{ return re.size(); }
+
+    complex<T> operator[](uint64_t k)const{
+        return complex<T>{re[k],im[k]};
+    }
+    reference operator[](uint64_t k){
+        if(k>=size()){
+            throw std::out_of_range("subscript ouf of range");
+        }
+        return reference{*this,k};
+    }
+
+    void push_back(const complex<T>& z){
+        re.push_back(z.real());
+        try{
+            im.push_back(z.imag());
+        }catch(...){
+            re.pop_back();
+            throw;
+        }
+    }
+
+    const_iterator begin(void)const{ return const_iterator{this,0}; }
+    const_iterator end(void)const{ return const_iterator{this,size()}; }
+};
+
+template<typename T>
+using split_valarray = Wrap<split_complex<T>>;
+
+template<typename T>
+struct chooseRef<split_complex<T>>{
+    using type = split_complex<T> const&;
+};
+
+// expressions with a split leaf anywhere multiply and divide with the fast functors
+template<typename T> struct has_split:std::false_type{};
+template<typename T> struct has_split<split_complex<T>>:std::true_type{};
+template<typename V1,typename V2,typename Op>
+struct has_split<BinaryProxy<V1,V2,Op>>:std::integral_constant<bool,has_split<V1>::value||has_split<V2>::value>{};
+template<typename V,typename Op>
+struct has_split<UnaryProxy<V,Op>>:has_split<V>{};
+
+template<typename T1,typename T2,typename = typename std::enable_if<has_split<T1>::value||has_split<T2>::value>::type>
+node_detail::arith<Wrap<T1>,Wrap<T2>,fast_multiplies> operator*(const Wrap<T1>& lhs,const Wrap<T2>& rhs){
+    return apply_op(lhs,rhs,fast_multiplies<typename node_detail::operands<Wrap<T1>,Wrap<T2>>::value_type>{});
+}
+template<typename T1,typename T2,typename = typename std::enable_if<has_split<T1>::value>::type>
+node_detail::arith<Wrap<T1>,T2,fast_multiplies> operator*(const Wrap<T1>& lhs,const T2& rhs){
+    return apply_op(lhs,rhs,fast_multiplies<typename node_detail::operands<Wrap<T1>,T2>::value_type>{});
+}
+template<typename T1,typename T2,typename = typename std::enable_if<has_split<T2>::value>::type>
+node_detail::arith<T1,Wrap<T2>,fast_multiplies> operator*(const T1& lhs,const Wrap<T2>& rhs){
+    return apply_op(lhs,rhs,fast_multiplies<typename node_detail::operands<T1,Wrap<T2>>::value_type>{});
+}
+template<typename T1,typename T2,typename = typename std::enable_if<has_split<T1>::value||has_split<T2>::value>::type>
+node_detail::arith<Wrap<T1>,Wrap<T2>,fast_divides> operator/(const Wrap<T1>& lhs,const Wrap<T2>& rhs){
+    return apply_op(lhs,rhs,fast_divides<typename node_detail::operands<Wrap<T1>,Wrap<T2>>::value_type>{});
+}
+template<typename T1,typename T2,typename = typename std::enable_if<has_split<T1>::value>::type>
+node_detail::arith<Wrap<T1>,T2,fast_divides> operator/(const Wrap<T1>& lhs,const T2& rhs){
+    return apply_op(lhs,rhs,fast_divides<typename node_detail::operands<Wrap<T1>,T2>::value_type>{});
+}
+template<typename T1,typename T2,typename = typename std::enable_if<has_split<T2>::value>::type>
+node_detail::arith<T1,Wrap<T2>,fast_divides> operator/(const T1& lhs,const Wrap<T2>& rhs){
+    return apply_op(lhs,rhs,fast_divides<typename node_detail::operands<T1,Wrap<T2>>::value_type>{});
+}
+
+// lazy conjugate of any complex valued expression
+template<typename T>
+typename operation_enable_if<is_complex<typename T::value_type>::flag,Wrap<UnaryProxy<T,fast_conj<typename T::value_type>>>>::type conj(const Wrap<T>& arg){
+    return Wrap<UnaryProxy<T,fast_conj<typename T::value_type>>>{arg,fast_conj<typename T::value_type>{}};
+}
+
+// eager whole-array forms; out must already hold min(a.size(), b.size())
+// (or a.size()) elements and may be a or b
+template<typename T>
+void multiply(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b){
+    split_detail::binary<split_detail::mul_step>(out,a,b);
+}
+template<typename T>
+void divide(split_complex<T>& out,const split_complex<T>& a,const split_complex<T>& b){
+    split_detail::binary<split_detail::div_step>(out,a,b);
+}
+template<typename T>
+void conjugate(split_complex<T>& out,const split_complex<T>& a){
+    split_detail::binary<split_detail::conj_step>(out,a,a);
+}
+template<typename T>
+void magnitude(vector<T>& out,const split_complex<T>& a){
+    uint64_t n = a.size();
+    if(out.size()<n){
+        throw std::out_of_range("magnitude destination is too short");
+    }
+    if(n==0) return;
+    split_detail::run<split_detail::abs_step>(split_detail::spans<T>{&out[0],nullptr,&a.re[0],&a.im[0],nullptr,nullptr},n);
+}
+
+/*********************************text output*****************************************************/
+// numbers go through std::to_chars into a caller owned buffer instead of
+// one iostream insertion per element; put_number returns nullptr when the
+// text does not fit in [first, last)
+inline char* put_done(std::to_chars_result r){
+    return r.ec==std::errc{} ? r.ptr : nullptr;
+}
+
+template<typename N>
+char* put_number(char* first,char* last,N val,std::chars_format,int,bool,std::true_type /*integral*/){
+    return put_done(std::to_chars(first,last,val));
+}
+
+template<typename N>
+char* put_number(char* first,char* last,N val,std::chars_format fmt,int precision,bool shortest,std::false_type){
+    if(shortest) return put_done(std::to_chars(first,last,val));
+    return put_done(std::to_chars(first,last,val,fmt,precision));
+}
+
+// masks print as 0 and 1, as iostream does without boolalpha
+inline char* put_number(char* first,char* last,bool val,std::chars_format,int,bool){
+    if(first==last) return nullptr;
+    *first++ = val ? '1' : '0';
+    return first;
+}
+
+template<typename N>
+char* put_number(char* first,char* last,N val,std::chars_format fmt,int precision,bool shortest){
+    return put_number(first,last,val,fmt,precision,shortest,typename std::is_integral<N>::type{});
+}
+
+// same shape as iostream's "(re,im)"
+template<typename N>
+char* put_number(char* first,char* last,complex<N> val,std::chars_format fmt,int precision,bool shortest){
+    if(first==last) return nullptr;
+    *first++ = '(';
+    first = put_number(first,last,val.real(),fmt,precision,shortest);
+    if(first==nullptr||first==last) return nullptr;
+    *first++ = ',';
+    first = put_number(first,last,val.imag(),fmt,precision,shortest);
+    if(first==nullptr||first==last) return nullptr;
+    *first++ = ')';
+    return first;
+}
+
+// room for any value of N: fixed notation of the largest double has 309
+// digits before the point, a long double up to 4933
+template<typename N>
+struct text_bound{
+    static uint64_t of(int precision){
+        return static_cast<uint64_t>(std::numeric_limits<N>::max_exponent10)+static_cast<uint64_t>(precision)+32;
+    }
+};
+template<typename N>
+struct text_bound<complex<N>>{
+    static uint64_t of(int precision){ return 2*text_bound<N>::of(precision)+3; }
+};
+
+// most values fit the stack buffer, the rest are retried in one big enough
+template<typename N>
+void append_number(std::string& buf,const N& val,std::chars_format fmt,int precision,bool shortest){
+    char tmp[128];
+    char* e = put_number(tmp,tmp+sizeof(tmp),val,fmt,precision,shortest);
+    if(e!=nullptr){
+        buf.append(tmp,e);
+        return;
+    }
+    std::string big(text_bound<N>::of(precision),'\0');
+    e = put_number(&big[0],&big[0]+big.size(),val,fmt,precision,shortest);
+    buf.append(&big[0],e);
+}
+
+// int8_t and uint8_t are numbers on both paths, not characters
+template<typename N>
+N print_value(const N& val,std::false_type){ return val; }
+template<typename N>
+auto print_value(const N& val,std::true_type)->decltype(+val){ return +val; }
+template<typename N>
+auto print_value(const N& val)->decltype(print_value(val,std::integral_constant<bool,std::is_integral<N>::value&&!std::is_same<N,bool>::value>{})){
+    return print_value(val,std::integral_constant<bool,std::is_integral<N>::value&&!std::is_same<N,bool>::value>{});
+}
+
+// buf is overwritten but keeps its capacity, so one buffer serves many dumps;
+// values use the shortest text that reads back exactly
+template<typename T>
+std::string& write_text(std::string& buf,const Wrap<T>& t,char sep = ' '){
+    buf.clear();
+    uint64_t n = t.size();
+    for(uint64_t k = 0;k<n;++k){
+        if(k) buf.push_back(sep);
+        append_number(buf,t[k],std::chars_format::general,0,true);
+    }
+    return buf;
+}
+
+template<typename T>
+std::ostream& operator<<(std::ostream& out,const Wrap<T>& t){
+    const std::ios_base::fmtflags special = std::ios_base::showpos|std::ios_base::uppercase|std::ios_base::showpoint
+                                           |std::ios_base::showbase|std::ios_base::hex|std::ios_base::oct|std::ios_base::boolalpha;
+    std::ios_base::fmtflags field = out.flags()&std::ios_base::floatfield;
+    const std::ios_base::fmtflags hexfloat = std::ios_base::fixed|std::ios_base::scientific;
+    if((out.flags()&special)||field==hexfloat||out.width()!=0){
+        // flags to_chars cannot express, let iostream do it
+        out<<"{ ";
+        for(uint64_t k = 0;k<t.size();++k){
+            out<<print_value(t[k])<<", ";
+        }
+        out<<" }";
+        return out;
+    }
+    std::chars_format fmt = std::chars_format::general;
+    if(field==std::ios_base::fixed) fmt = std::chars_format::fixed;
+    else if(field==std::ios_base::scientific) fmt = std::chars_format::scientific;
+    int precision = static_cast<int>(out.precision());
+
+    static thread_local std::string buf;
+    buf = "{ ";
+    for(uint64_t k = 0;k<t.size();++k){
+        append_number(buf,t[k],fmt,precision,false);
+        buf += ", ";
+    }
+    buf += " }";
+    out.write(buf.data(),buf.size());
+    return out;
+}
+
+/*********************************text input*****************************************************/
+template<typename N>
+const char* read_number(const char* first,const char* p,const char* last,N& val){
+    if(p!=last&&*p=='+') p++;
+    auto r = std::from_chars(p,last,val);
+    if(r.ec!=std::errc()){
+        throw std::invalid_argument("bad number at offset "+std::to_string(p-first));
+    }
+    return r.ptr;
+}
+
+// "(re,im)" or a plain real number
+template<typename N>
+const char* read_number(const char* first,const char* p,const char* last,complex<N>& val){
+    N re = 0,im = 0;
+    if(*p=='('){
+        p = read_number(first,p+1,last,re);
+        if(p==last||*p!=','){
+            throw std::invalid_argument("bad complex number at offset "+std::to_string(p-first));
+        }
+        p = read_number(first,p+1,last,im);
+        if(p==last||*p!=')'){
+            throw std::invalid_argument("bad complex number at offset "+std::to_string(p-first));
+        }
+        p++;
+    }else{
+        p = read_number(first,p,last,re);
+    }
+    val = complex<N>{re,im};
+    return p;
+}
+
+// appends every number in [first,last) to out; whitespace, commas and
+// braces separate values, so CSV rows and operator<< output both parse
+template<typename T>
+uint64_t parse_text(const char* first,const char* last,vector<T>& out){
+    uint64_t count = 0;
+    const char* p = first;
+    for(;;){
+        while(p!=last&&(*p==' '||*p=='\t'||*p=='\n'||*p=='\r'||*p==','||*p=='{'||*p=='}')) p++;
+        if(p==last) break;
+        T val;
+        p = read_number(first,p,last,val);
+        out.push_back(val);
+        count++;
+    }
+    return count;
+}
+
+template<typename T>
+uint64_t parse_text(const std::string& text,vector<T>& out){
+    return parse_text(text.data(),text.data()+text.size(),out);
 }
 
 
@@ -2,7 +2,9 @@
 #define _VECTOR_H_
 
 #include <cstdint>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 
 //Utility gives std::rel_ops which will fill in relational
@@ -47,26 +49,50 @@ namespace epl{
         uint64_t reallocate_times;
         uint64_t vector_version;
         
+        T* inline_buf = nullptr;        // in-object storage of a small_vector, never freed here
+        uint64_t inline_capacity = 0;
         
-        
-        
-    public:
-        vector(void){
+    protected:
+        // used by small_vector to hand over its in-object buffer
+        vector(T* buf,uint64_t n) noexcept{
             len = 0;
-            capacity = unit_capacity;
-            data = reinterpret_cast<T*> (operator new(sizeof(T)*capacity ));
+            capacity = n;
+            data = buf;
             start = capacity/3;
             dstart = data+start;
             myend = start;
             dend = data+myend;
+            inline_buf = buf;
+            inline_capacity = n;
+            
+            reallocate_times = 0;
+            vector_version = 0;
+        }
+        
+        // small_vector's moves: a source on its inline buffer has its elements
+        // moved one by one into this vector's inline buffer, which is as large
+        void move_assign(vector<T>&& rhs){
+            if(this!= &rhs){
+                destroy();
+                my_move(std::move(rhs));
+            }
+            ++reallocate_times;
+            ++vector_version;
+        }
+        
+    public:
+        using value_type = T;
+        
+        // nothing is allocated until the first element arrives
+        vector(void) noexcept{
+            reset_empty();
             
             reallocate_times = 0;
             vector_version = 0;
         }
         
-        explicit vector(uint64_t n){
-            if(n==0) vector(); // bad , right way?? or Vector()?
-            else{
+        explicit vector(uint64_t n):vector(){
+            if(n!=0){
                 len = n;
                 capacity = n;
                 data = reinterpret_cast<T*> (operator new(sizeof(T)*capacity));
@@ -103,14 +129,16 @@ namespace epl{
         
         /*********************move construcot and assignment**************************/
         
-        vector(vector<T>&& that){
+        // a vector outside a small_vector always owns a heap buffer (or none),
+        // so a move only steals it
+        vector(vector<T>&& that) noexcept{
             my_move(std::move(that)); // why use this-> ?
             
             reallocate_times = 0;
             vector_version = 0;
         }
         
-        vector<T>& operator=(vector<T>&& rhs){
+        vector<T>& operator=(vector<T>&& rhs) noexcept{
             if(this!= &rhs){    // still need this condition or not?
                 destroy();
                 my_move(std::move(rhs));
@@ -130,6 +158,11 @@ namespace epl{
             return this->len;
         }
         
+        // bumped by every modification, iterators compare against it
+        uint64_t version(void) const{
+            return this->vector_version;
+        }
+        
         T& operator[](uint64_t k){
             if(k>=len){
                 throw std::out_of_range("subscript ouf of range");
@@ -154,23 +187,7 @@ namespace epl{
         
         void push_back(T const& val){
             if(dend == data+capacity){
-                reallocate_times++;
-                capacity *= 2;
-                T* tmp_data = reinterpret_cast<T*> (operator new(capacity * sizeof(T)));   // if it needs doubling, how to initialize it?
-                start = capacity/3;                                                 // with invokes T::T(void) default contructor or not?
-                myend = start;
-                new (tmp_data+start+len) T{val};
-                for(uint64_t k = 0;k<len;k+=1){
-                    new (tmp_data+myend) T{std::move(dstart[k])};
-                    myend++;
-                }
-               
-                myend++;
-                len++;
-                destroy();
-                data = tmp_data;
-                dstart = data+start;
-                dend = data + myend;
+                grow_emplace(len,val);
             }else{
                 
                 new (data+myend) T{val};
@@ -184,27 +201,7 @@ namespace epl{
         
         void push_back(T&& val){
             if(dend == data+capacity){
-                reallocate_times++;
-//                uint64_t tmp_start = start;
-//                uint64_t tmp_end = myend;
-//                uint64_t tmp_capacity = capacity;
-                capacity *= 2;
-                T* tmp_data = reinterpret_cast<T*> (operator new(capacity * sizeof(T)));   // if it needs doubling, how to initialize it?
-                start = capacity/3;                                                 // with invokes T::T(void) default contructor or not?
-                myend = start;
-                new (tmp_data+len+start) T{std::move(val)};
-                for(uint64_t k = 0;k<len;k+=1){
-                    new (tmp_data+myend) T{std::move(dstart[k])};
-                    myend++;
-                }
-             
-                myend++;
-                len++;
-                destroy();
-                data = tmp_data;
-                dstart = data+start;
-                dend = data + myend;
-                
+                grow_emplace(len,std::move(val));
             }else{
                 new (data+myend) T{std::move(val)};
                 myend++;
@@ -222,31 +219,8 @@ namespace epl{
         
         void push_front(T const& val){
             if(start == 0){
-                reallocate_times++;
-//                uint64_t tmp_start = start;
-//                uint64_t tmp_end = myend;
-//                uint64_t tmp_capacity = capacity;
-                capacity *= 2;
-                T* tmp_data = reinterpret_cast<T*> (operator new(capacity * sizeof(T)));   // if it needs doubling, how to initialize it?
-                start = capacity/3;
-                myend = start;
-                
-                new (tmp_data+start-1) T{val};
-                
-                for(uint64_t i= 0;i<len;i++){
-                    new (tmp_data+myend) T{std::move(data[i])};
-                    myend++;
-                }
-              
-                start--;
-                len++;
-                destroy();
-                data = tmp_data;
-                dstart = data+start;
-                dend = data + myend;
-                
+                grow_emplace(0,val);
             }else{
-              //  if(start == 0) start = capacity;
                 start--;
                 new (data+start) T{val};
                 len++;
@@ -259,28 +233,8 @@ namespace epl{
         
         void push_front(T&& val){
             if(dstart==data){
-                reallocate_times++;
-                capacity *= 2;
-                T* tmp_data = reinterpret_cast<T*> (operator new(capacity * sizeof(T)));   // if it needs doubling, how to initialize it?
-                start = capacity/3;                                                 // with invokes T::T(void) default contructor or not?
-                myend = start;
-                
-                new (tmp_data+start-1) T{std::move(val)};
-                
-                for(uint64_t i= 0;i<len;i++){
-                    new (tmp_data+myend) T{std::move(data[i])};
-                    myend++;
-                }
-              
-                start--;
-                len++;
-                destroy();
-                data = tmp_data;
-                dstart = data + start;
-                dend = data + myend;
-                
+                grow_emplace(0,std::move(val));
             }else{
-               // if(start == 0) start = capacity;
                 start--;
                 new (data+start) T{std::move(val)};
                 len++;
@@ -752,14 +706,7 @@ namespace epl{
         }
         template<typename iter>
         void initialize_dispatch(iter b,iter e,std::input_iterator_tag){
-            std::cout<<"wenwen"<<std::endl;
-            capacity = unit_capacity;
-            data = reinterpret_cast<T*>(operator new(sizeof(T)* capacity));
-            dstart = data;
-            start = 0;
-            myend = 0;
-            len = 0;         
-            dend = data;
+            reset_empty();
             for(;b!=e;b++){
                 push_back(*b);
                 
@@ -812,50 +759,253 @@ namespace epl{
         template<typename... Args>
         void emplace_back(Args&&... args ){
             if(dend==data+capacity){
-                reallocate_times++;
-                capacity *= 2;
-                T* tmp_data = reinterpret_cast<T*> (operator new(capacity*sizeof(T)));
-                start = capacity/3;
-                myend = start;
-                new(tmp_data+len)T{std::forward<Args>(args)...};
-
-                for(int i = 0;i<len;i++){
-                    new(tmp_data+myend) T{std::move(*(data+i))};
-                    myend++;
-                }
-                len++;
-                myend = len;
-                destroy();
-                data = tmp_data;
-                dstart = tmp_data + start;
-                dend = tmp_data + myend; 
-
-
+                grow_emplace(len,std::forward<Args>(args)...);
             }else{
-                new (data+len) T{ std::forward<Args>(args)... };
+                new (data+myend) T{ std::forward<Args>(args)... };
                 len++;
                 dend++;
                 myend++;
 
             }
             vector_version++;
-            
+
         }
-        
+
+        /*********************erase / insert in the middle**************************/
+        // there is slack on both ends, so only the shorter half is shifted
+        iterator erase(const_iterator pos){
+            pos.check_invalid();
+            uint64_t idx = pos.index;
+            if(idx>=len){
+                throw std::out_of_range("erase position out of range");
+            }
+            if(idx < len-1-idx){
+                for(uint64_t k = idx;k>0;k--){
+                    dstart[k] = std::move(dstart[k-1]);
+                }
+                dstart->~T();
+                start++;
+                dstart++;
+            }else{
+                for(uint64_t k = idx;k+1<len;k++){
+                    dstart[k] = std::move(dstart[k+1]);
+                }
+                (dend-1)->~T();
+                myend--;
+                dend--;
+            }
+            len--;
+            vector_version++;
+            return iterator{this,dstart+idx};
+        }
+
+        iterator erase(const_iterator first,const_iterator last){
+            first.check_invalid();
+            last.check_invalid();
+            uint64_t idx = first.index;
+            if(last.index<idx||last.index>len){
+                throw std::out_of_range("erase range out of range");
+            }
+            uint64_t n = last.index - idx;
+            if(n==0) return iterator{this,dstart+idx};
+            if(idx < len-idx-n){
+                for(uint64_t k = idx;k>0;k--){
+                    dstart[k-1+n] = std::move(dstart[k-1]);
+                }
+                for(uint64_t k = 0;k<n;k++){
+                    (dstart+k)->~T();
+                }
+                start += n;
+                dstart += n;
+            }else{
+                for(uint64_t k = idx+n;k<len;k++){
+                    dstart[k-n] = std::move(dstart[k]);
+                }
+                for(uint64_t k = len-n;k<len;k++){
+                    (dstart+k)->~T();
+                }
+                myend -= n;
+                dend -= n;
+            }
+            len -= n;
+            vector_version++;
+            return iterator{this,dstart+idx};
+        }
+
+        iterator insert(const_iterator pos,T const& val){
+            return insert(pos,1,val);
+        }
+
+        iterator insert(const_iterator pos,uint64_t n,T const& val){
+            pos.check_invalid();
+            uint64_t idx = pos.index;
+            if(idx>len){
+                throw std::out_of_range("insert position out of range");
+            }
+            if(n==0) return iterator{this,dstart+idx};
+            T tmp{val}; // val may live inside this vector
+
+            bool front_shorter = idx < len-idx;
+            if(front_shorter&&start>=n){
+                shift_front(idx,n,tmp);
+            }else if(!front_shorter&&capacity-myend>=n){
+                shift_back(idx,n,tmp);
+            }else if(start>=n){
+                shift_front(idx,n,tmp);
+            }else if(capacity-myend>=n){
+                shift_back(idx,n,tmp);
+            }else if(inline_buf!=nullptr&&data==inline_buf&&len+n<=capacity){
+                slide((capacity-len-n)/3);
+                shift_back(idx,n,tmp);
+            }else{
+                uint64_t total = len+n;
+                uint64_t new_capacity = capacity==0 ? unit_capacity : capacity*2;
+                while(new_capacity<total+total/2){
+                    new_capacity *= 2;
+                }
+                reallocate(new_capacity,(new_capacity-total)/3,idx,n,[&](T* p){ new (p) T{tmp}; });
+            }
+            vector_version++;
+            return iterator{this,dstart+idx};
+        }
+
+        /*********************erase_if, one pass compaction**************************/
+        template<typename Pred>
+        uint64_t erase_if(Pred pred){
+            uint64_t w = 0;
+            for(uint64_t r = 0;r<len;r++){
+                if(!pred(dstart[r])){
+                    if(w!=r) dstart[w] = std::move(dstart[r]);
+                    w++;
+                }
+            }
+            uint64_t removed = len-w;
+            for(uint64_t k = w;k<len;k++){
+                (dstart+k)->~T();
+            }
+            len = w;
+            myend = start+w;
+            dend = dstart+w;
+            if(removed) vector_version++;
+            return removed;
+        }
+
     private:
+        // grow for one new element at pos (0 or len), built from args
+        template<typename... Args>
+        void grow_emplace(uint64_t pos,Args&&... args){
+            if(inline_buf!=nullptr&&data==inline_buf&&len<capacity){
+                // still fits inline, recentre instead of spilling to the heap
+                T tmp{std::forward<Args>(args)...};
+                uint64_t slack = capacity-len;
+                slide(pos==0 ? slack-slack/3 : slack/3);
+                if(pos==0){
+                    start--;
+                    dstart--;
+                    new (dstart) T{std::move(tmp)};
+                }else{
+                    new (dend) T{std::move(tmp)};
+                    myend++;
+                    dend++;
+                }
+                len++;
+                return;
+            }
+            uint64_t new_capacity = capacity==0 ? unit_capacity : capacity*2;
+            reallocate(new_capacity,new_capacity/3,pos,1,[&](T* p){ new (p) T{std::forward<Args>(args)...}; });
+        }
+
+        // move everything into a new buffer at new_start, leaving n slots at pos
+        // for fill() to construct. The new slots are built first, since the value
+        // may live in the old buffer. Elements are only moved when that cannot
+        // throw (std::move_if_noexcept), otherwise copied, so if anything throws
+        // the vector is left untouched (strong guarantee).
+        template<typename Fill>
+        void reallocate(uint64_t new_capacity,uint64_t new_start,uint64_t pos,uint64_t n,Fill fill){
+            T* tmp_data = reinterpret_cast<T*> (operator new(new_capacity * sizeof(T)));
+            T* gap = tmp_data+new_start+pos;
+            uint64_t built = 0;
+            uint64_t moved = 0;
+            try{
+                for(;built<n;built++){
+                    fill(gap+built);
+                }
+                for(;moved<len;moved++){
+                    T* to = tmp_data+new_start+(moved<pos ? moved : moved+n);
+                    new (to) T{std::move_if_noexcept(dstart[moved])};
+                }
+            }catch(...){
+                for(uint64_t k = 0;k<built;k++){
+                    (gap+k)->~T();
+                }
+                for(uint64_t k = 0;k<moved;k++){
+                    (tmp_data+new_start+(k<pos ? k : k+n))->~T();
+                }
+                operator delete(tmp_data);
+                throw;
+            }
+            destroy();
+            reallocate_times++;
+            data = tmp_data;
+            capacity = new_capacity;
+            start = new_start;
+            len += n;
+            myend = start+len;
+            dstart = data+start;
+            dend = data+myend;
+        }
+
+        // open a gap of n at idx by moving [0,idx) n slots towards the front
+        void shift_front(uint64_t idx,uint64_t n,T const& val){
+            T* dst = dstart-n;
+            for(uint64_t k = 0;k<idx;k++){
+                if(dst+k<dstart) new (dst+k) T{std::move(dstart[k])};
+                else dst[k] = std::move(dstart[k]);
+            }
+            for(T* p = dst+idx;p!=dstart+idx;p++){
+                if(p<dstart) new (p) T{val};
+                else *p = val;
+            }
+            start -= n;
+            dstart = dst;
+            len += n;
+        }
+
+        // open a gap of n at idx by moving [idx,len) n slots towards the back
+        void shift_back(uint64_t idx,uint64_t n,T const& val){
+            for(uint64_t k = len;k>idx;k--){
+                T* to = dstart+k-1+n;
+                if(to>=dend) new (to) T{std::move(dstart[k-1])};
+                else *to = std::move(dstart[k-1]);
+            }
+            for(T* p = dstart+idx;p!=dstart+idx+n;p++){
+                if(p>=dend) new (p) T{val};
+                else *p = val;
+            }
+            myend += n;
+            dend += n;
+            len += n;
+        }
+
         void copy(vector<T> const& that){
             this->len = that.len;
-            this->capacity = that.capacity;
-            data = reinterpret_cast<T*> (operator new(capacity * sizeof(T)));
-            this->start = that.start;
-            this->myend = that.myend;
+            if(inline_buf!=nullptr&&that.len<=inline_capacity){
+                this->capacity = inline_capacity;
+                data = inline_buf;
+                this->start = (capacity-len)/3;
+            }else{
+                this->capacity = that.capacity;
+                data = reinterpret_cast<T*> (operator new(capacity * sizeof(T)));
+                this->start = that.start;
+            }
+            this->myend = start+len;
             this->dstart = data+start;
             this->dend = data+myend;
             
           
 //            if(start<=myend)
-                for(uint64_t k = start;k<myend;k+=1){
-                    new (data+k) T{that.data[k]};
+                for(uint64_t k = 0;k<len;k+=1){
+                    new (dstart+k) T{that.dstart[k]};
                 }
 //            else{
 //                for(uint64_t k = 0;k<myend;k+=1){
@@ -868,25 +1018,39 @@ namespace epl{
             
         }
         
+        // only small_vector's move_assign sees a tmp on its inline buffer; those
+        // elements cannot be stolen. If one of their moves throws, *this is
+        // left empty and tmp keeps all of its elements
         void my_move(vector<T>&& tmp) {
-          
-            this->data = tmp.data;
-            this->len = tmp.len;
-            this->capacity = tmp.capacity;
-            this->start = tmp.start;
-            this->myend = tmp.myend;
-            this->dstart = tmp.dstart;
-            this->dend = tmp.dend;
-           
-         
-            
-            tmp.data = nullptr;
-            tmp.myend = 0;
-            tmp.start = 0;
-            tmp.len = 0;
-            tmp.capacity = 0;
-            tmp.dstart = nullptr;
-            tmp.dend = nullptr;
+            if(tmp.inline_buf!=nullptr&&tmp.data==tmp.inline_buf){
+                reset_empty();
+                start = (capacity-tmp.len)/3;
+                dstart = data+start;
+                uint64_t k = 0;
+                try{
+                    for(;k<tmp.len;k++){
+                        new (dstart+k) T{std::move(tmp.dstart[k])};
+                    }
+                }catch(...){
+                    while(k>0) (dstart+(--k))->~T();
+                    reset_empty();
+                    throw;
+                }
+                tmp.destroy();
+                this->len = tmp.len;
+                this->myend = start+len;
+                this->dend = data+myend;
+            }else{
+                this->data = tmp.data;
+                this->len = tmp.len;
+                this->capacity = tmp.capacity;
+                this->start = tmp.start;
+                this->myend = tmp.myend;
+                this->dstart = tmp.dstart;
+                this->dend = tmp.dend;
+            }
+            
+            tmp.reset_empty();
             tmp.vector_version++;
             tmp.reallocate_times++;
         }
@@ -913,11 +1077,140 @@ namespace epl{
 //            }
             
             
-            operator delete (data);
+            if(data!=inline_buf) operator delete (data);
             
         }
         
+        // an empty vector, back on the inline buffer if there is one
+        void reset_empty(void){
+            data = inline_buf;
+            capacity = inline_capacity;
+            len = 0;
+            start = capacity/3;
+            myend = start;
+            dstart = data+start;
+            dend = data+myend;
+        }
+        
+        // move the elements inside the current buffer so that they begin at new_start
+        void slide(uint64_t new_start){
+            T* to = data+new_start;
+            if(to<dstart){
+                for(uint64_t k = 0;k<len;k++){
+                    if(to+k<dstart) new (to+k) T{std::move(dstart[k])};
+                    else to[k] = std::move(dstart[k]);
+                }
+                for(T* p = (to+len>dstart ? to+len : dstart);p<dend;p++){
+                    p->~T();
+                }
+            }else if(to>dstart){
+                for(uint64_t k = len;k>0;k--){
+                    if(to+k-1>=dend) new (to+k-1) T{std::move(dstart[k-1])};
+                    else to[k-1] = std::move(dstart[k-1]);
+                }
+                for(T* p = dstart;p<(to<dend ? to : dend);p++){
+                    p->~T();
+                }
+            }
+            start = new_start;
+            myend = start+len;
+            dstart = to;
+            dend = to+len;
+        }
+        
+        
+    };
+    
+    /*********************small_vector, up to N elements kept inline**************************/
+    template<typename T,uint64_t N>
+    struct small_vector_storage{
+        alignas(T) unsigned char buf[N*sizeof(T)];
+    };
+    
+    // same double-ended layout, iterators and API as vector<T>; the buffer
+    // lives inside the object until more than N elements are needed. The
+    // vector<T> base is private: moving a small_vector has to move inline
+    // elements one by one, which vector's noexcept move must never be asked to
+    template<typename T,uint64_t N>
+    class small_vector : private small_vector_storage<T,N>, private vector<T>{
+        static_assert(N>0,"small_vector needs room for at least one element");
+        using storage = small_vector_storage<T,N>;
+        using base = vector<T>;
+        
+    public:
+        using typename base::value_type;
+        using typename base::iterator;
+        using typename base::const_iterator;
+        using base::size;
+        using base::version;
+        using base::operator[];
+        using base::push_back;
+        using base::push_front;
+        using base::emplace_back;
+        using base::pop_back;
+        using base::pop_front;
+        using base::begin;
+        using base::end;
+        using base::erase;
+        using base::erase_if;
+        using base::insert;
         
+        // the elements as a plain vector, e.g. for the valarray and parallel headers
+        base const& as_vector(void) const{ return *this; }
+        
+        // storage is left uninitialized, the elements are constructed into it
+        small_vector(void) noexcept:vector<T>(reinterpret_cast<T*>(storage::buf),N){}
+        
+        explicit small_vector(uint64_t n):small_vector(){
+            for(uint64_t k = 0;k<n;k++){
+                this->emplace_back();
+            }
+        }
+        
+        template<typename iter>
+        small_vector(iter b,iter e):small_vector(){
+            for(;b!=e;++b){
+                this->push_back(*b);
+            }
+        }
+        
+        small_vector(std::initializer_list<T> list):small_vector(list.begin(),list.end()){}
+        
+        small_vector(small_vector const& that):small_vector(){
+            base::operator=(that);
+        }
+        
+        small_vector(vector<T> const& that):small_vector(){
+            base::operator=(that);
+        }
+        
+        small_vector(small_vector&& that):small_vector(){
+            base::move_assign(std::move(that));
+        }
+        
+        small_vector(vector<T>&& that) noexcept:small_vector(){
+            base::operator=(std::move(that));
+        }
+        
+        small_vector& operator=(small_vector const& rhs){
+            base::operator=(rhs);
+            return *this;
+        }
+        
+        small_vector& operator=(small_vector&& rhs){
+            base::move_assign(std::move(rhs));
+            return *this;
+        }
+        
+        small_vector& operator=(vector<T> const& rhs){
+            base::operator=(rhs);
+            return *this;
+        }
+        
+        small_vector& operator=(vector<T>&& rhs) noexcept{
+            base::operator=(std::move(rhs));
+            return *this;
+        }
     };
     
 } //namespace epl
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# expr_depth.py -- compile time and object size of deep valarray expressions
+#
+#   python3 bench/expr_depth.py [tree ...]
+#
+# Each tree is a checkout of this repo (default: the one holding this
+# script); to compare against an older Valarray.h, add a worktree with
+# git worktree add /tmp/old <commit> and pass both. The headers are staged
+# with VectorPhaseC2.h as Vector.h, since Valarray.h includes "Vector.h".
+#
+# For each depth d a translation unit holds four functions
+# r = (((x op a) op b) ...) of d binary ops, ops cycling through + * - /
+# and operands through x, y, z, 2.0. It is compiled with -O2 (fastest of
+# three runs, text size) and once with -O0 -g (object size).
+# DEPTHS="8 32" and CXX=clang++ override the defaults.
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+OPS = '+*-/'
+ARGS = ['x', 'y', 'z', '2.0']
+
+
+def expr(depth, seed):
+    e = 'x'
+    for i in range(depth):
+        e = '(%s%s%s)' % (e, OPS[(i+seed) % 4], ARGS[(i*3+seed) % 4])
+    return e
+
+
+def source(depth):
+    src = '#include "Vector.h"\n#include "Valarray.h"\n'
+    for s in range(4):
+        src += ('void f%d(valarray<double>& r,const valarray<double>& x,'
+                'const valarray<double>& y,const valarray<double>& z){ r = %s; }\n' % (s, expr(depth, s)))
+    return src
+
+
+def stage(tree, into):
+    for name in os.listdir(tree):
+        if name.endswith('.h'):
+            shutil.copy(os.path.join(tree, name), into)
+    shutil.copy(os.path.join(tree, 'VectorPhaseC2.h'), os.path.join(into, 'Vector.h'))
+
+
+def compile_seconds(cxx, flags, cpp, obj):
+    start = time.time()
+    subprocess.run([cxx, '-std=c++17'] + flags + ['-c', cpp, '-o', obj], check=True)
+    return time.time()-start
+
+
+def text_size(obj):
+    out = subprocess.run(['size', obj], capture_output=True, text=True, check=True).stdout
+    return int(out.split('\n')[1].split()[0])
+
+
+def main():
+    here = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    trees = sys.argv[1:] or [here]
+    depths = [int(d) for d in os.environ.get('DEPTHS', '1 2 4 8 16 32').split()]
+    cxx = os.environ.get('CXX', 'g++')
+    print('%-24s %5s %9s %8s %10s %11s' % ('tree', 'depth', 'O2 time', 'O2 text', 'O0-g time', 'O0-g object'))
+    for tree in trees:
+        with tempfile.TemporaryDirectory() as work:
+            stage(tree, work)
+            cpp = os.path.join(work, 'depth.cpp')
+            obj = os.path.join(work, 'depth.o')
+            for d in depths:
+                with open(cpp, 'w') as f:
+                    f.write(source(d))
+                o2 = min(compile_seconds(cxx, ['-O2'], cpp, obj) for _ in range(3))
+                text = text_size(obj)
+                o0 = compile_seconds(cxx, ['-O0', '-g'], cpp, obj)
+                print('%-24s %5d %8.2fs %8d %9.2fs %11d' % (tree[-24:], d, o2, text, o0, os.path.getsize(obj)), flush=True)
+
+
+if __name__ == '__main__':
+    main()
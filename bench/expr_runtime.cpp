@@ -0,0 +1,45 @@
+// expr_runtime.cpp -- ns per element of valarray assignment from expression trees
+//
+// Valarray.h includes "Vector.h", so the headers are staged with VectorPhaseC2.h under that name:
+//   mkdir -p /tmp/epl && cp *.h /tmp/epl && cp VectorPhaseC2.h /tmp/epl/Vector.h && g++ -std=c++17 -O2 -I/tmp/epl bench/expr_runtime.cpp -o expr_runtime
+
+#include <chrono>
+#include <cstdio>
+#include "Vector.h"
+#include "Valarray.h"
+
+// best of reps runs, in microseconds
+template<typename F>
+double best(F f,int reps){
+    double fastest = 1e30;
+    for(int r = 0;r<reps;r++){
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double us = std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-start).count();
+        if(us<fastest) fastest = us;
+    }
+    return fastest;
+}
+
+int main(void){
+    const uint64_t n = 4096;
+    const int reps = 3000;
+    valarray<double> x(n),y(n),z(n),r(n);
+    for(uint64_t k = 0;k<n;k++){
+        x[k] = 1+k%7;
+        y[k] = 2+k%5;
+        z[k] = 0.5+k%3;
+    }
+    volatile double sink;
+    double fma = best([&]{ r = x*y+z; sink = r[0]; },reps);
+    double wide = best([&]{ r = (x-y)*(x+y)/(z+1.0) + x*z - y*0.25 + (x+z)*(y-z)*2.0; sink = r[0]; },reps);
+    double unary = best([&]{ r = -x + x.sqrt(); sink = r[0]; },reps);
+    double deep = best([&]{ r = ((((((((x+y)*z)-x)/y)+z)*x)-y)/z); sink = r[0]; },reps);
+    (void)sink;
+    std::printf("ns per element, n = %llu\n",static_cast<unsigned long long>(n));
+    std::printf("  a*b+c    %.2f\n",fma*1e3/n);
+    std::printf("  13 ops   %.2f\n",wide*1e3/n);
+    std::printf("  unary    %.2f\n",unary*1e3/n);
+    std::printf("  depth 8  %.2f\n",deep*1e3/n);
+    return 0;
+}
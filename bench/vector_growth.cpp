@@ -0,0 +1,49 @@
+// vector_growth.cpp -- push_back/push_front through epl::vector's reallocation path
+//
+//   g++ -std=c++17 -O2 -I. bench/vector_growth.cpp -o vector_growth && ./vector_growth
+//
+// Every push that hits a full buffer goes through the one reallocate()
+// helper, so these loops time the growth path as a whole. Each figure is
+// the best of seven runs, in milliseconds.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "VectorPhaseC2.h"
+
+template<typename F>
+double best_ms(F f){
+    double fastest = 1e30;
+    for(int r = 0;r<7;r++){
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-start).count();
+        if(ms<fastest) fastest = ms;
+    }
+    return fastest;
+}
+
+int main(void){
+    volatile uint64_t sink = 0;
+    double ints = best_ms([&]{
+        epl::vector<int> v;
+        for(int k = 0;k<20000000;k++) v.push_back(k);
+        sink = v.size();
+    });
+    double strings = best_ms([&]{
+        epl::vector<std::string> v;
+        std::string s = "a string past the small buffer";
+        for(int k = 0;k<2000000;k++) v.push_back(s);
+        sink = v.size();
+    });
+    double fronts = best_ms([&]{
+        epl::vector<double> v;
+        for(int k = 0;k<20000000;k++) v.push_front(k);
+        sink = v.size();
+    });
+    (void)sink;
+    std::printf("int push_back 20M       %7.1f ms\n",ints);
+    std::printf("string push_back 2M     %7.1f ms\n",strings);
+    std::printf("double push_front 20M   %7.1f ms\n",fronts);
+    return 0;
+}